@@ -0,0 +1,179 @@
+/**
+ * \author Koen Eelen
+ */
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+#include "anomaly.h"
+
+#define STATE_ALIGN(size) (((size) + _Alignof(max_align_t) - 1) & ~(_Alignof(max_align_t) - 1))
+
+struct anomaly_state {
+    int count;                                                  /**< number of detectors this state was created for */
+    const anomaly_detector_t *detectors[ANOMALY_MAX_DETECTORS];
+    size_t offsets[ANOMALY_MAX_DETECTORS];                      /**< offset of the state of each detector in 'data' */
+    _Alignas(max_align_t) unsigned char data[];
+};
+
+/*
+ * stuck sensor detector
+ */
+typedef struct {
+    sensor_value_t last_value;
+    int repeats;
+} stuck_state_t;
+
+static void stuck_init(void *state)
+{
+    ((stuck_state_t *)state)->repeats = 0;
+}
+
+static bool stuck_check(void *state, const sensor_data_t *data, double *detail)
+{
+    stuck_state_t *s = state;
+    if (s->repeats > 0 && data->value == s->last_value) s->repeats++;
+    else s->repeats = 1;
+    s->last_value = data->value;
+    *detail = s->repeats;
+    return s->repeats == ANOMALY_STUCK_READINGS; //report once per stuck period
+}
+
+/*
+ * spike detector, exponentially weighted mean and variance
+ */
+typedef struct {
+    double mean;
+    double var;
+    int n;
+    int flagged;        /**< flagged readings in a row */
+} spike_state_t;
+
+static void spike_init(void *state)
+{
+    memset(state, 0, sizeof(spike_state_t));
+}
+
+static void spike_update(spike_state_t *s, double diff, double alpha)
+{
+    double incr = alpha * diff;
+    s->mean += incr;
+    s->var = (1 - alpha) * (s->var + diff * incr);
+}
+
+static bool spike_check(void *state, const sensor_data_t *data, double *detail)
+{
+    spike_state_t *s = state;
+    double diff = data->value - s->mean;
+    double var = fmax(s->var, ANOMALY_SPIKE_MIN_STDDEV * ANOMALY_SPIKE_MIN_STDDEV);
+    if (s->n >= ANOMALY_SPIKE_WARMUP && fabs(diff) > ANOMALY_SPIKE_K * sqrt(var))
+    {
+        *detail = data->value;
+        if (++s->flagged < ANOMALY_SPIKE_REBASELINE)
+        {
+            //down-weighted: a single spike barely moves the mean, a lasting shift is followed
+            spike_update(s, diff, ANOMALY_SPIKE_ALPHA * ANOMALY_SPIKE_FLAGGED_WEIGHT);
+        } else
+        {
+            s->mean = data->value;
+            s->var = 0;
+            s->n = 1;
+            s->flagged = 0;
+        }
+        return true;
+    }
+    s->flagged = 0;
+    if (s->n == 0)
+    {
+        s->mean = data->value;
+    } else
+    {
+        spike_update(s, diff, ANOMALY_SPIKE_ALPHA);
+    }
+    s->n++;
+    return false;
+}
+
+/*
+ * rate-of-change detector
+ */
+typedef struct {
+    sensor_value_t last_value;
+    sensor_ts_t last_ts;
+    bool valid;
+} slope_state_t;
+
+static void slope_init(void *state)
+{
+    ((slope_state_t *)state)->valid = false;
+}
+
+static bool slope_check(void *state, const sensor_data_t *data, double *detail)
+{
+    slope_state_t *s = state;
+    bool anomaly = false;
+    if (s->valid && data->ts > s->last_ts)
+    {
+        *detail = (data->value - s->last_value) * 60 / (data->ts - s->last_ts);
+        anomaly = fabs(*detail) > ANOMALY_MAX_SLOPE;
+    }
+    s->last_value = data->value;
+    s->last_ts = data->ts;
+    s->valid = true;
+    return anomaly;
+}
+
+static const anomaly_detector_t stuck_detector = {"stuck sensor", sizeof(stuck_state_t), stuck_init, stuck_check};
+static const anomaly_detector_t spike_detector = {"spike", sizeof(spike_state_t), spike_init, spike_check};
+static const anomaly_detector_t slope_detector = {"rate of change", sizeof(slope_state_t), slope_init, slope_check};
+
+static const anomaly_detector_t *detectors[ANOMALY_MAX_DETECTORS] = {&stuck_detector, &spike_detector, &slope_detector};
+static int detector_count = 3;
+
+int anomaly_register(const anomaly_detector_t *detector)
+{
+    if (detector_count == ANOMALY_MAX_DETECTORS) return -1;
+    detectors[detector_count++] = detector;
+    return 0;
+}
+
+anomaly_state_t *anomaly_create()
+{
+    size_t size = 0;
+    for (int i = 0; i < detector_count; i++) size += STATE_ALIGN(detectors[i]->state_size);
+    anomaly_state_t *state = malloc(sizeof(anomaly_state_t) + size);
+    assert(state != NULL);
+    state->count = detector_count;
+    size = 0;
+    for (int i = 0; i < detector_count; i++)
+    {
+        state->detectors[i] = detectors[i];
+        state->offsets[i] = size;
+        detectors[i]->init(state->data + size);
+        size += STATE_ALIGN(detectors[i]->state_size);
+    }
+    return state;
+}
+
+int anomaly_check(anomaly_state_t *state, const sensor_data_t *data, anomaly_report_t report, void *arg)
+{
+    int found = 0;
+    for (int i = 0; i < state->count; i++)
+    {
+        double detail = 0;
+        if (state->detectors[i]->check(state->data + state->offsets[i], data, &detail))
+        {
+            report(state->detectors[i], data, detail, arg);
+            found++;
+        }
+    }
+    return found;
+}
+
+void anomaly_free(anomaly_state_t **state)
+{
+    free(*state);
+    *state = NULL;
+}
@@ -0,0 +1,112 @@
+/**
+ * \author Koen Eelen
+ */
+
+#ifndef _ANOMALY_H_
+#define _ANOMALY_H_
+
+#include <stdlib.h>
+#include "config.h"
+#include "lib/dplist.h"
+
+/*
+ * stuck sensor: the same value is reported ANOMALY_STUCK_READINGS times in a row
+ */
+#ifndef ANOMALY_STUCK_READINGS
+#define ANOMALY_STUCK_READINGS 10
+#endif
+
+/*
+ * spike: a single reading deviates more than ANOMALY_SPIKE_K standard deviations from the exponentially weighted
+ * mean (weight ANOMALY_SPIKE_ALPHA), only checked after ANOMALY_SPIKE_WARMUP readings
+ */
+#ifndef ANOMALY_SPIKE_K
+#define ANOMALY_SPIKE_K 4.0
+#endif
+
+#ifndef ANOMALY_SPIKE_ALPHA
+#define ANOMALY_SPIKE_ALPHA 0.1
+#endif
+
+#ifndef ANOMALY_SPIKE_WARMUP
+#define ANOMALY_SPIKE_WARMUP 10
+#endif
+
+/*
+ * The standard deviation used by the spike detector never drops below ANOMALY_SPIKE_MIN_STDDEV (about the resolution
+ * of a sensor), so a sensor that reports a constant value isn't flagged on its first small change
+ */
+#ifndef ANOMALY_SPIKE_MIN_STDDEV
+#define ANOMALY_SPIKE_MIN_STDDEV 0.1
+#endif
+
+/*
+ * A flagged reading still updates the mean and variance, with ANOMALY_SPIKE_FLAGGED_WEIGHT times the normal weight.
+ * After ANOMALY_SPIKE_REBASELINE flagged readings in a row the level is taken to have shifted: the detector restarts
+ * from the last reading (including the warm-up), instead of flagging every reading from then on.
+ */
+#ifndef ANOMALY_SPIKE_FLAGGED_WEIGHT
+#define ANOMALY_SPIKE_FLAGGED_WEIGHT 0.25
+#endif
+
+#ifndef ANOMALY_SPIKE_REBASELINE
+#define ANOMALY_SPIKE_REBASELINE 5
+#endif
+
+/*
+ * rate-of-change: the temperature changes faster than ANOMALY_MAX_SLOPE degrees per minute between 2 readings
+ */
+#ifndef ANOMALY_MAX_SLOPE
+#define ANOMALY_MAX_SLOPE 30.0
+#endif
+
+#ifndef ANOMALY_MAX_DETECTORS
+#define ANOMALY_MAX_DETECTORS 8
+#endif
+
+/**
+ * A detector only sees the readings of one sensor, in timestamp order, and keeps its state in a block of
+ * 'state_size' bytes that is allocated per sensor. 'check' must run in O(1).
+ */
+typedef struct {
+    const char *name;
+    size_t state_size;
+    void (*init)(void *state);
+    /* returns true if 'data' is anomalous, '*detail' is filled out with the value that triggered the detector */
+    bool (*check)(void *state, const sensor_data_t *data, double *detail);
+} anomaly_detector_t;
+
+typedef struct anomaly_state anomaly_state_t;
+
+typedef void (*anomaly_report_t)(const anomaly_detector_t *detector, const sensor_data_t *data, double detail, void *arg);
+
+/**
+ * Adds a detector to the set that is run on every reading, the stuck, spike and slope detectors are registered by default
+ * Only sensors for which anomaly_create() is called afterwards get the new detector
+ * \param detector a pointer to a detector that stays valid for the lifetime of the program
+ * \return 0 on success, -1 if ANOMALY_MAX_DETECTORS is reached
+ */
+int anomaly_register(const anomaly_detector_t *detector);
+
+/**
+ * Allocates and initializes the state of all registered detectors for one sensor
+ * \return a pointer to the newly allocated state
+ */
+anomaly_state_t *anomaly_create();
+
+/**
+ * Runs all detectors on a reading and calls 'report' for every detector that flags it
+ * \param state the state of the sensor the reading belongs to
+ * \param data the reading
+ * \param report callback function that handles an anomaly
+ * \param arg passed on to 'report'
+ * \return the number of detectors that flagged the reading
+ */
+int anomaly_check(anomaly_state_t *state, const sensor_data_t *data, anomaly_report_t report, void *arg);
+
+/**
+ * Frees the state allocated by anomaly_create(), '*state' is set to NULL
+ */
+void anomaly_free(anomaly_state_t **state);
+
+#endif  //_ANOMALY_H_
@@ -4,6 +4,34 @@
 #include <stdint.h>
 #include <time.h>
 
+// stringify preprocessor directives using 2-level preprocessor magic
+// this avoids using directives like -DDB_NAME=\"some_db_name\"
+#define REAL_TO_STRING(s) #s
+#define TO_STRING(s) REAL_TO_STRING(s)    //force macro-expansion on s before stringify s
+
+/*
+ * Names of the storage files, kept here so the event log can mention them without including the storage modules
+ */
+#ifndef DB_NAME
+#define DB_NAME Sensor.db
+#endif
+
+#ifndef TABLE_NAME
+#define TABLE_NAME SensorData
+#endif
+
+#ifndef DB_SPOOL_FILE
+#define DB_SPOOL_FILE sensor_spool.bin
+#endif
+
+#ifndef DB_QUARANTINE_FILE
+#define DB_QUARANTINE_FILE sensor_quarantine.bin
+#endif
+
+#ifndef TSDB_DIR
+#define TSDB_DIR sensor_tsdb
+#endif
+
 typedef uint16_t sensor_id_t, room_id_t;
 typedef double sensor_value_t;     
 typedef time_t sensor_ts_t;
@@ -13,6 +41,65 @@ typedef struct{
 	sensor_value_t value;
 	sensor_ts_t ts;
 } sensor_data_t;
+
+/*
+ * A reading on the wire: <sensor_id><temperature><timestamp>, without padding
+ */
+#define SENSOR_RECORD_BYTES (sizeof(sensor_id_t) + sizeof(sensor_value_t) + sizeof(sensor_ts_t))
+
+/*
+ * Record in which readings are buffered and written to binary files, converted from and to sensor_data_t at the edges
+ * With -DCOMPACT_RECORDS a record takes 8 bytes instead of 24: the value in int16 centi-degrees (+-327.67, rounded
+ * to 0.01 and clamped) and the timestamp in int32 seconds relative to the epoch of the buffer or file segment
+ */
+#ifdef COMPACT_RECORDS
+typedef struct{
+	int16_t value;
+	sensor_id_t id;
+	int32_t ts;
+} sensor_record_t;
+
+static inline void sensor_record_pack(sensor_record_t *record, const sensor_data_t *data, sensor_ts_t epoch)
+{
+	double centi = data->value * 100;
+	if (centi > INT16_MAX) centi = INT16_MAX;
+	if (centi < INT16_MIN) centi = INT16_MIN;
+	record->value = (int16_t)(centi < 0 ? centi - 0.5 : centi + 0.5);
+	record->id = data->id;
+	record->ts = (int32_t)(data->ts - epoch);
+}
+
+static inline void sensor_record_unpack(sensor_data_t *data, const sensor_record_t *record, sensor_ts_t epoch)
+{
+	data->id = record->id;
+	data->value = record->value / 100.0;
+	data->ts = epoch + record->ts;
+}
+#else
+typedef sensor_data_t sensor_record_t;
+
+static inline void sensor_record_pack(sensor_record_t *record, const sensor_data_t *data, sensor_ts_t epoch)
+{
+	*record = *data;
+}
+
+static inline void sensor_record_unpack(sensor_data_t *data, const sensor_record_t *record, sensor_ts_t epoch)
+{
+	*data = *record;
+}
+#endif
+
+/*
+ * Header of a binary file of sensor_record_t, 'epoch' is the time the file was created
+ * A file written with a different record size (the other COMPACT_RECORDS setting) is not read
+ */
+#define SENSOR_SEGMENT_MAGIC 0x53474553     // "SEGS" on little-endian
+
+typedef struct{
+	uint32_t magic;
+	uint32_t record_size;
+	int64_t epoch;
+} sensor_segment_t;
 			
 
 #endif /* _CONFIG_H_ */
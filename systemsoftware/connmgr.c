@@ -3,6 +3,8 @@
 #include "connmgr.h"
 #include <sys/epoll.h>    
 #include "sbuffer.h"
+#include "logger.h"
+#include "lib/dphash.h"
 #include <string.h>
 #include <unistd.h>
 
@@ -14,19 +16,20 @@
                       }                                 \
                     } while(0)
 
-dplist_t * connection_list;
+dphash_t * connection_map;          /**< the sensor connections by socket descriptor */
+connection_t * server_connection;
 
 void *connection_copy(void *sensor);
 void connection_free(void **sensor);
-int connection_compare(void *x, void *y);
+static int connection_receive(connection_t *connection, sbuffer_t *sbuffer, bool drain);
+static void connection_tune(tcpsock_t *socket);
 
 void connmgr_listen(int port_number, sbuffer_t *sbuffer){
     /*---Define local variables & such---*/
-    connection_list = dpl_create(connection_copy, connection_free, connection_compare);
+    connection_map = dph_create_int(connection_copy, connection_free);
     tcpsock_t *server;
     int fd;
     bool terminate = false;
-    char * msg;
 
     /*---Start tcp connection---*/
     if(tcp_passive_open(&server, port_number) != TCP_NO_ERROR) {
@@ -36,11 +39,11 @@ void connmgr_listen(int port_number, sbuffer_t *sbuffer){
         printf("socket not yet bound\n");
     }
 
-    /*---Add socket to list---*/
-    connection_t * server_connection = malloc(sizeof(connection_t));
+    /*---Keep the server socket apart from the sensor connections---*/
+    server_connection = malloc(sizeof(connection_t));
+    assert(server_connection != NULL);
     server_connection->socket = server;
     server_connection->last_record = time(NULL); 
-    connection_list = dpl_insert_at_index(connection_list, server_connection, 0, false);
 
     /*---Add socket to epoll---*/
     int epfd = epoll_create(1);
@@ -60,27 +63,26 @@ void connmgr_listen(int port_number, sbuffer_t *sbuffer){
     while(!terminate)
     {
         /*--- IF NO CONNECTIONS -> CHECK FOR TIMEOUT --- */
-        if (dpl_size(connection_list) == 1 && server_connection->last_record + TIMEOUT - 0.0001 < time(NULL))
+        if (dph_size(connection_map) == 0 && server_connection->last_record + TIMEOUT - 0.0001 < time(NULL))
         {
             printf("CONNMGR TIMEOUT\n");
             tcp_close(&(server_connection->socket)); 
-            connection_list = dpl_remove_at_index(connection_list,0,true);
+            connection_free((void **)&server_connection);
             sbuffer_remove_locks(sbuffer);
             terminate = true;
             break;
         }
 
         /*--- CHECK FOR TIMEOUTS --- */
-        for (int k = 1; k<dpl_size(connection_list); k++)
+        dphash_iter_t iter;
+        for (connection_t * dummy = dph_iter_first(connection_map, &iter); dummy != NULL; dummy = dph_iter_next(&iter))
         {
-            connection_t * dummy = dpl_get_element_at_index(connection_list,k);
             if(dummy->last_record + TIMEOUT < time(NULL))
             {
                 printf("SENSOR TIMEOUT\n");
                 tcp_close(&(dummy->socket)); 
-                connection_list = dpl_remove_at_index(connection_list,k,true);
+                dph_iter_remove(&iter, true);
                 server_connection->last_record = time(NULL);
-                break;
             }
         }
 
@@ -88,35 +90,10 @@ void connmgr_listen(int port_number, sbuffer_t *sbuffer){
         int num_ready = epoll_wait(epfd, events, 64, TIMEOUT*1000);
         for(int i = 0; i < num_ready; i++) 
         {
-            // check for EPOLLRDHUP events
-            if(events[i].events & EPOLLRDHUP)
+            // new connections
+            if(events[i].data.fd == fd)
             {
-                for (int a = 1; a<dpl_size(connection_list); a++)
-                {
-                    connection_t * dummy = dpl_get_element_at_index(connection_list,a);
-                    int dummy_sd = 0;
-                    if(tcp_get_sd(dummy->socket,&dummy_sd) != TCP_NO_ERROR) {
-                        printf("socket not yet bound\n");
-                    }
-                    if(dummy_sd == events[i].data.fd)
-                    {
-                        printf("A sensor node with id:%d has closed the connection.\n", dummy->sensor_id);
-                        asprintf(&msg, "A sensor node with id:%d has closed the connection.", dummy->sensor_id);
-                        write(sbuffer_get_pfd(sbuffer), msg, strlen(msg)+1);
-                        free(msg);
-                
-                        tcp_close(&(dummy->socket)); 
-                        connection_list = dpl_remove_at_index(connection_list,a,true);
-                        server_connection->last_record = time(NULL);
-                        break;
-                    }
-                }
-            }
-
-            // check for EPOLLIN events
-            if(events[i].events & EPOLLIN)
-            {
-                if (events[i].data.fd == fd)
+                if(events[i].events & EPOLLIN)
                 {
                     tcpsock_t * sensor_socket;
 
@@ -125,6 +102,7 @@ void connmgr_listen(int port_number, sbuffer_t *sbuffer){
                     if(tcp_get_sd(sensor_socket,&fd) != TCP_NO_ERROR) { 
                         printf("socket not yet bound\n");
                     }
+                    connection_tune(sensor_socket);
                     event.data.fd = fd;
                     int s = epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &event);
                     if (s == -1)
@@ -133,56 +111,84 @@ void connmgr_listen(int port_number, sbuffer_t *sbuffer){
                         abort ();
                     }
 
-                    /*---Add new connection to list---*/
+                    /*---Add new connection to the map---*/
                     connection_t dummy;
                     dummy.socket = sensor_socket;
                     dummy.last_record = time(NULL); 
                     dummy.sensor_id = -1;
-                    connection_list = dpl_insert_at_index(connection_list, &dummy, 10000, true);
-                }   else
+                    connection_map = dph_insert_int(connection_map, fd, &dummy, true);
+                }
+                continue;
+            }
+
+            // readings, and on EPOLLRDHUP whatever the sensor node sent before it closed the connection
+            connection_t * dummy = dph_get_int(connection_map, events[i].data.fd);
+            if(dummy != NULL)
+            {
+                bool closed = (events[i].events & EPOLLRDHUP) != 0;
+                if(connection_receive(dummy, sbuffer, closed) != TCP_NO_ERROR) closed = true;
+                if(closed)
                 {
-                    for (int j = 1; j<dpl_size(connection_list); j++)
-                    {
-                        connection_t * dummy = dpl_get_element_at_index(connection_list,j);
-                        int dummy_sd = 0;
-                        int result = 0;
-                        if(tcp_get_sd(dummy->socket,&dummy_sd) != TCP_NO_ERROR) {
-                            printf("socket not yet bound\n");
-                        }
-                        if(dummy_sd == events[i].data.fd)
-                        {  
-                            int bytes;
-                            sensor_data_t data;
-                            bytes = sizeof(data.id);
-                            result = tcp_receive(dummy->socket, (void *) &data.id, &bytes);
-                            bytes = sizeof(data.value);
-                            result = tcp_receive(dummy->socket, (void *) &data.value, &bytes);
-                            bytes = sizeof(data.ts);
-                            result = tcp_receive(dummy->socket, (void *) &data.ts, &bytes);
-                            dummy->last_record = data.ts;
-                            if ((result == TCP_NO_ERROR) && bytes) {
-                                sbuffer_insert(sbuffer, &data);
-                            }
-                            if(dummy->sensor_id == -1)
-                            {
-                                printf("A sensor node with id:%d has opened a new connection.\n", data.id);
-                                asprintf(&msg, "A sensor node with id:%d has opened a new connection.", data.id);
-                                write(sbuffer_get_pfd(sbuffer), msg, strlen(msg)+1);
-                                free(msg);
-                                dummy->sensor_id = data.id;
-                            }
-                        }
-                    }
+                    printf("A sensor node with id:%d has closed the connection.\n", dummy->sensor_id);
+                    logger_event(LOG_SENSOR_CLOSED, dummy->sensor_id, 0, 0);
+            
+                    tcp_close(&(dummy->socket)); 
+                    connection_map = dph_remove_int(connection_map, events[i].data.fd, true);
+                    server_connection->last_record = time(NULL);
                 }
             }
         }
     }
 }
 
+/*
+ * One receive into the buffer of the socket (until the end of the stream if 'drain'), every complete reading in
+ * the buffer is parsed from memory and inserted in the sbuffer. A partial reading stays buffered for the next call.
+ */
+static int connection_receive(connection_t *connection, sbuffer_t *sbuffer, bool drain)
+{
+    int result, bytes, buffered;
+    do
+    {
+        result = tcp_fill(connection->socket, &bytes);
+        if (bytes > 0) connection->last_record = time(NULL);
+
+        while (tcp_peek(connection->socket, NULL, &buffered) == TCP_NO_ERROR && buffered >= SENSOR_RECORD_BYTES)
+        {
+            sensor_data_t data;
+            tcp_receive_exact(connection->socket, (void *) &data.id, sizeof(data.id));
+            tcp_receive_exact(connection->socket, (void *) &data.value, sizeof(data.value));
+            tcp_receive_exact(connection->socket, (void *) &data.ts, sizeof(data.ts));
+            sbuffer_insert(sbuffer, &data);
+            if(connection->sensor_id == -1)
+            {
+                printf("A sensor node with id:%d has opened a new connection.\n", data.id);
+                logger_event(LOG_SENSOR_OPENED, data.id, 0, 0);
+                connection->sensor_id = data.id;
+            }
+        }
+    } while (drain && result == TCP_NO_ERROR);
+    return (result == TCP_WOULD_BLOCK && !drain) ? TCP_NO_ERROR : result;
+}
+
+/*
+ * Applies the CONNMGR_... socket options, a failing option is reported and the connection is kept with the default
+ */
+static void connection_tune(tcpsock_t *socket)
+{
+    if (CONNMGR_NONBLOCKING && tcp_set_nonblocking(socket, 1) != TCP_NO_ERROR) printf("Can't make a sensor connection non-blocking.\n");
+    if (CONNMGR_RCVBUF > 0 && tcp_set_rcvbuf(socket, CONNMGR_RCVBUF) != TCP_NO_ERROR) printf("Can't set the receive buffer of a sensor connection.\n");
+    if (tcp_set_keepalive(socket, CONNMGR_KEEPALIVE_IDLE, CONNMGR_KEEPALIVE_INTERVAL, CONNMGR_KEEPALIVE_COUNT) != TCP_NO_ERROR)
+    {
+        printf("Can't set keepalive on a sensor connection.\n");
+    }
+    if (CONNMGR_BUSY_POLL > 0 && tcp_set_busy_poll(socket, CONNMGR_BUSY_POLL) != TCP_NO_ERROR) printf("Can't set busy polling on a sensor connection.\n");
+}
+
 void connmgr_free()
 {
-    dpl_free(&connection_list, true);
-    connection_list = NULL;
+    dph_free(&connection_map, true);
+    if (server_connection != NULL) connection_free((void **)&server_connection);
 }
 
 
@@ -202,8 +208,3 @@ void connection_free(void **x)
     *x = NULL;
 }
 
-int connection_compare(void *x, void *y)
-{
-    if(((connection_t*)x)->last_record == ((connection_t*)y)->last_record) return 0;
-    else return 1;
-}
@@ -14,6 +14,38 @@
   #error TIMEOUT not specified!(in seconds)
 #endif
 
+/*
+ * Socket options applied to every accepted sensor connection, see the tcp_set_... functions of lib/tcpsock.h
+ *  CONNMGR_NONBLOCKING: receive without ever blocking the connmgr on a single sensor
+ *  CONNMGR_RCVBUF: kernel receive buffer in bytes for bursts of backlogged readings, 0 leaves it to autotuning
+ *  CONNMGR_KEEPALIVE_*: a dead sensor node is dropped after IDLE + INTERVAL * COUNT s, even while TIMEOUT is long.
+ *                       An IDLE of 0 turns keepalive off.
+ *  CONNMGR_BUSY_POLL: us of busy polling per receive, 0 turns it off (more needs CAP_NET_ADMIN)
+ */
+#ifndef CONNMGR_NONBLOCKING
+#define CONNMGR_NONBLOCKING 1
+#endif
+
+#ifndef CONNMGR_RCVBUF
+#define CONNMGR_RCVBUF 0
+#endif
+
+#ifndef CONNMGR_KEEPALIVE_IDLE
+#define CONNMGR_KEEPALIVE_IDLE 30
+#endif
+
+#ifndef CONNMGR_KEEPALIVE_INTERVAL
+#define CONNMGR_KEEPALIVE_INTERVAL 5
+#endif
+
+#ifndef CONNMGR_KEEPALIVE_COUNT
+#define CONNMGR_KEEPALIVE_COUNT 3
+#endif
+
+#ifndef CONNMGR_BUSY_POLL
+#define CONNMGR_BUSY_POLL 0
+#endif
+
 typedef struct{
     tcpsock_t* socket;
     time_t last_record;
@@ -6,12 +6,17 @@
 #include <stdio.h>
 #include "config.h"
 #include "lib/dplist.h"
+#include "lib/dphash.h"
 #include "datamgr.h"
 #include "sbuffer.h"
+#include "logger.h"
+#include "anomaly.h"
 #include <assert.h>
 #include <string.h>
 #include <inttypes.h>
 #include <unistd.h>
+#include <sys/stat.h>
+#include <stdatomic.h>
 
 
 #define ERROR_HANDLER(condition, ...)    do {                       \
@@ -27,31 +32,66 @@ typedef struct {
     room_id_t room_id; 
     sensor_value_t temperatures[RUN_AVG_LENGTH];
     sensor_ts_t last_modified;
+    sensor_value_t min_temp;        /**< lower limit, loaded from the map file or THRESHOLD_FILE */
+    sensor_value_t max_temp;        /**< upper limit, loaded from the map file or THRESHOLD_FILE */
+    alert_state_t alert;            /**< the alert state that was last reported */
+    alert_state_t alert_pending;    /**< the alert state that is waiting out ALERT_DWELL */
+    sensor_ts_t alert_since;        /**< timestamp at which alert_pending was first seen */
+    sensor_ts_t alert_reported;     /**< timestamp of the last alert message */
+    sensor_data_t reorder[REORDER_SLOTS];  /**< held back readings, sorted on timestamp */
+    int reorder_count;
+    sensor_ts_t newest_ts;          /**< newest timestamp seen, the window trails this one */
+    unsigned int late_readings;
+    anomaly_state_t *anomaly;       /**< state of the streaming anomaly detectors */
+    atomic_uint seq;                /**< seqlock sequence number, odd while 'published' is being updated */
+    sensor_snapshot_t published;    /**< the state readers see, only written by sensor_publish() */
 } sensor_t;
 
-dplist_t * sensor_list;
+dphash_t * sensor_map;              /**< sensor_t's by sensor id */
 void *sensor_copy(void *sensor);
 void sensor_free(void **sensor);
-int sensor_compare(void *x, void *y);
+static void datamgr_update_alert(sensor_t *sensor, double running_avg, sensor_ts_t ts);
+static void datamgr_load_thresholds(FILE *fp_sensor_map);
+static bool datamgr_thresholds_changed();
+static void sensor_publish(sensor_t *sensor, sensor_value_t running_avg);
+static void datamgr_reorder_reading(sensor_t *sensor, sensor_data_t *data);
+static void datamgr_release_readings(sensor_t *sensor, sensor_ts_t watermark);
+static void datamgr_apply_reading(sensor_t *sensor, sensor_data_t *data);
+static void datamgr_report_anomaly(const anomaly_detector_t *detector, const sensor_data_t *data, double detail, void *arg);
 
 void datamgr_parse_from_buffer(FILE *fp_sensor_map, sbuffer_t *sbuffer, int datamgr_id)
 {
-    sensor_list = dpl_create(sensor_copy,sensor_free,sensor_compare);
+    sensor_map = dph_create_int(sensor_copy,sensor_free);
     room_id_t room_id;
     sensor_id_t sensor_id;
+    char line[128];
 
     //get list of sensors
-    while (fscanf(fp_sensor_map, "%hd %hd", &room_id, &sensor_id) == 2)
+    while (fgets(line, sizeof(line), fp_sensor_map) != NULL)
     {
+        if (sscanf(line, "%hu %hu", &room_id, &sensor_id) != 2) continue;
+        if (dph_get_int(sensor_map, sensor_id) != NULL) continue;
         sensor_t * sensor = malloc(sizeof(sensor_t));
         assert(sensor!=NULL);
         sensor->sensor_id = sensor_id;
         sensor->room_id = room_id;
         memset(sensor->temperatures, 0, RUN_AVG_LENGTH*sizeof(sensor_value_t));
-        sensor_list = dpl_insert_at_index(sensor_list, sensor, 0, false);
+        sensor->last_modified = 0;
+        sensor->alert = sensor->alert_pending = ALERT_NORMAL;
+        sensor->alert_since = sensor->alert_reported = 0;
+        sensor->reorder_count = 0;
+        sensor->newest_ts = 0;
+        sensor->late_readings = 0;
+        sensor->anomaly = anomaly_create();
+        atomic_init(&sensor->seq, 0);
+        memset(&sensor->published, 0, sizeof(sensor_snapshot_t));
+        sensor_map = dph_insert_int(sensor_map, sensor_id, sensor, false);
     }
+    datamgr_thresholds_changed();
+    datamgr_load_thresholds(fp_sensor_map);
 
     time_t last_read = time(NULL);
+    time_t last_reload_check = last_read;
     bool terminate = false;
     while(!terminate)
     {
@@ -62,110 +102,334 @@ void datamgr_parse_from_buffer(FILE *fp_sensor_map, sbuffer_t *sbuffer, int data
         {
             //printf("reading data: %"PRIu16" - %g - %ld\n", data.id, data.value, data.ts);
             last_read = time(NULL);
-            char * msg;
-            sensor_t sensor;
-            sensor.sensor_id = data.id;
-            sensor_t * dummy = dpl_get_element(sensor_list, &sensor);
+            sensor_t * dummy = dph_get_int(sensor_map, data.id);
             if (dummy == NULL) 
             {
                 printf("Received sensor data with invalid sensor node ID:%"PRIu16"\n", data.id);
-                asprintf(&msg, "Received sensor data with invalid sensor node ID:%"PRIu16, data.id);
-                write(sbuffer_get_pfd(sbuffer), msg, strlen(msg)+1);
-                free(msg);
+                logger_event(LOG_SENSOR_INVALID, data.id, 0, 0);
             } else {
-                //temperature
-                double temp = 0;
-                temp += data.value;
-                for(int i=RUN_AVG_LENGTH-1 ;0<i ;i--)
-                {
-                    dummy->temperatures[i]=dummy->temperatures[i-1];
-                    temp += dummy->temperatures[i];
-                }
-                double running_avg = temp/RUN_AVG_LENGTH;
-                dummy->temperatures[0] = data.value;
-                dummy->last_modified = data.ts;
-                
-                if (running_avg < SET_MIN_TEMP && !(dummy->temperatures[RUN_AVG_LENGTH-1]==0))
-                {
-                    printf("The sensor node with id:%"PRIu16" reports it’s too cold (running avg %f)\n", data.id, running_avg);
-                    asprintf(&msg, "The sensor node with id:%"PRIu16" reports it’s too cold (running avg %f)", data.id, running_avg);
-                    write(sbuffer_get_pfd(sbuffer), msg, strlen(msg)+1);
-                    free(msg);
-                } else if (running_avg > SET_MAX_TEMP && !(dummy->temperatures[RUN_AVG_LENGTH-1]==0))
-                {
-                    printf("The sensor node with id:%"PRIu16" reports it’s too hot (running avg %f)\n", data.id, running_avg);
-                    asprintf(&msg, "The sensor node with id:%"PRIu16" reports it’s too hot (running avg %f)", data.id, running_avg);
-                    write(sbuffer_get_pfd(sbuffer), msg, strlen(msg)+1);
-                    free(msg);
-                }
+                datamgr_reorder_reading(dummy, &data);
             }
         
         } else {
             //printf("datamgr is polling...\n");
         }
 
+        if(last_reload_check + THRESHOLD_RELOAD <= time(NULL))
+        {
+            last_reload_check = time(NULL);
+            if (datamgr_thresholds_changed())
+            {
+                // reopen by path: a map file that was replaced by rename(2) is a new inode, the old stream still reads the old one
+                FILE *fp_reloaded = fopen(SENSOR_MAP_FILE, "r");
+                datamgr_load_thresholds(fp_reloaded != NULL ? fp_reloaded : fp_sensor_map);
+                if (fp_reloaded != NULL) fclose(fp_reloaded);
+                printf("Temperature thresholds reloaded.\n");
+                logger_event(LOG_THRESHOLDS_RELOADED, 0, 0, 0);
+            }
+        }
+
         if(last_read + TIMEOUT < time(NULL))
         {
             printf("DATAMGR TIMEOUT\n");
             terminate = true;
         }
     }
+
+    //apply whatever is still held back in the reorder windows
+    dphash_iter_t iter;
+    for (sensor_t *sensor = dph_iter_first(sensor_map, &iter); sensor != NULL; sensor = dph_iter_next(&iter))
+    {
+        if (sensor->reorder_count > 0) datamgr_release_readings(sensor, sensor->newest_ts);
+    }
 }
 
-void datamgr_free()
+/*
+ * Insertion sort into the (small) reorder window, then applies every reading the window has passed
+ */
+static void datamgr_reorder_reading(sensor_t *sensor, sensor_data_t *data)
 {
-    dpl_free(&sensor_list, true);
+    if (sensor->reorder_count == REORDER_SLOTS)
+    {
+        datamgr_release_readings(sensor, sensor->reorder[0].ts);
+    }
+    if (data->ts < sensor->last_modified)
+    {
+        sensor->late_readings++;
+        sensor_publish(sensor, sensor->published.running_avg);
+        return;
+    }
+    int i = sensor->reorder_count;
+    while (i > 0 && sensor->reorder[i-1].ts > data->ts)
+    {
+        sensor->reorder[i] = sensor->reorder[i-1];
+        i--;
+    }
+    sensor->reorder[i] = *data;
+    sensor->reorder_count++;
+    if (data->ts > sensor->newest_ts) sensor->newest_ts = data->ts;
+    datamgr_release_readings(sensor, sensor->newest_ts - REORDER_WINDOW);
 }
 
-uint16_t datamgr_get_room_id(sensor_id_t sensor_id)
+/*
+ * Applies the held back readings with a timestamp up to 'watermark', oldest first
+ */
+static void datamgr_release_readings(sensor_t *sensor, sensor_ts_t watermark)
 {
-    for (int i = 0; i < dpl_size(sensor_list); i++)
+    int released = 0;
+    while (released < sensor->reorder_count && sensor->reorder[released].ts <= watermark)
     {
-        sensor_t * sensor = (sensor_t *)(dpl_get_element_at_index(sensor_list,i));
-        if (sensor->sensor_id == sensor_id)
+        datamgr_apply_reading(sensor, &sensor->reorder[released]);
+        released++;
+    }
+    if (released == 0) return;
+    sensor->reorder_count -= released;
+    memmove(sensor->reorder, sensor->reorder + released, sensor->reorder_count*sizeof(sensor_data_t));
+}
+
+static void datamgr_apply_reading(sensor_t *sensor, sensor_data_t *data)
+{
+    //temperature
+    double temp = 0;
+    temp += data->value;
+    for(int i=RUN_AVG_LENGTH-1 ;0<i ;i--)
+    {
+        sensor->temperatures[i]=sensor->temperatures[i-1];
+        temp += sensor->temperatures[i];
+    }
+    double running_avg = temp/RUN_AVG_LENGTH;
+    sensor->temperatures[0] = data->value;
+    sensor->last_modified = data->ts;
+    anomaly_check(sensor->anomaly, data, datamgr_report_anomaly, NULL);
+
+    if (!(sensor->temperatures[RUN_AVG_LENGTH-1]==0))
+    {
+        datamgr_update_alert(sensor, running_avg, data->ts);
+    } else
+    {
+        running_avg = 0;
+    }
+    sensor_publish(sensor, running_avg);
+}
+
+static void datamgr_report_anomaly(const anomaly_detector_t *detector, const sensor_data_t *data, double detail, void *arg)
+{
+    printf("The sensor node with id:%"PRIu16" reports an anomaly: %s (%g at %ld)\n", data->id, detector->name, detail, (long)data->ts);
+    logger_anomaly(data->id, detector->name, detail, data->ts);
+}
+
+/*
+ * Classifies the running avg, taking the hysteresis band of the currently reported state into account
+ */
+static alert_state_t alert_classify(sensor_t *sensor, double running_avg)
+{
+    if (sensor->alert == ALERT_TOO_HOT && running_avg > sensor->max_temp - ALERT_HYSTERESIS) return ALERT_TOO_HOT;
+    if (sensor->alert == ALERT_TOO_COLD && running_avg < sensor->min_temp + ALERT_HYSTERESIS) return ALERT_TOO_COLD;
+    if (running_avg > sensor->max_temp) return ALERT_TOO_HOT;
+    if (running_avg < sensor->min_temp) return ALERT_TOO_COLD;
+    return ALERT_NORMAL;
+}
+
+/*
+ * Only state transitions (and the optional ALERT_REMINDER) produce a message, a room that stays too hot
+ * doesn't flood stdout and the log
+ */
+static void datamgr_update_alert(sensor_t *sensor, double running_avg, sensor_ts_t ts)
+{
+    alert_state_t state = alert_classify(sensor, running_avg);
+    bool reminder = false;
+    if (state == sensor->alert)
+    {
+        sensor->alert_pending = state;
+        if (state == ALERT_NORMAL || ALERT_REMINDER <= 0 || ts - sensor->alert_reported < ALERT_REMINDER) return;
+        reminder = true;
+    } else
+    {
+        if (state != sensor->alert_pending)
         {
-            return sensor->room_id;
+            sensor->alert_pending = state;
+            sensor->alert_since = ts;
         }
+        if (ts - sensor->alert_since < ALERT_DWELL) return;
+        sensor->alert = state;
+    }
+    sensor->alert_reported = ts;
+
+    const char *report = reminder ? "still reports" : "reports";
+    switch (state)
+    {
+        case ALERT_TOO_COLD:
+            printf("The sensor node with id:%"PRIu16" %s it’s too cold (running avg %f)\n", sensor->sensor_id, report, running_avg);
+            logger_event(reminder ? LOG_STILL_TOO_COLD : LOG_TOO_COLD, sensor->sensor_id, 0, running_avg);
+            break;
+        case ALERT_TOO_HOT:
+            printf("The sensor node with id:%"PRIu16" %s it’s too hot (running avg %f)\n", sensor->sensor_id, report, running_avg);
+            logger_event(reminder ? LOG_STILL_TOO_HOT : LOG_TOO_HOT, sensor->sensor_id, 0, running_avg);
+            break;
+        default:
+            printf("The sensor node with id:%"PRIu16" reports the temperature is back to normal (running avg %f)\n", sensor->sensor_id, running_avg);
+            logger_event(LOG_BACK_TO_NORMAL, sensor->sensor_id, 0, running_avg);
+            break;
     }
-    ERROR_HANDLER(true, "Wrong sensor data"); //if we get this far, the sensor has not been found
 }
 
-sensor_value_t datamgr_get_avg(sensor_id_t sensor_id)
+/*
+ * Limits are resolved once per (re)load and stored in the sensor itself, so the hot path doesn't need any extra lookup
+ */
+static void datamgr_load_thresholds(FILE *fp_sensor_map)
 {
-    for (int i = 0; i < dpl_size(sensor_list); i++)
+    dphash_iter_t iter;
+    for (sensor_t *sensor = dph_iter_first(sensor_map, &iter); sensor != NULL; sensor = dph_iter_next(&iter))
     {
-        sensor_t * sensor = (sensor_t *)(dpl_get_element_at_index(sensor_list,i));
-        if (sensor->sensor_id == sensor_id)
+        sensor->min_temp = SET_MIN_TEMP;
+        sensor->max_temp = SET_MAX_TEMP;
+    }
+
+    room_id_t room_id;
+    sensor_id_t sensor_id;
+    sensor_value_t min_temp, max_temp;
+    char line[128];
+
+    //per room limits
+    FILE *fp = fopen(THRESHOLD_FILE, "r");
+    if (fp != NULL)
+    {
+        while (fgets(line, sizeof(line), fp) != NULL)
         {
-            if (sensor->temperatures[RUN_AVG_LENGTH-1]==0) return 0;
-            double temp = 0;
-            for(int i=0; i < RUN_AVG_LENGTH; i++)
+            if (sscanf(line, "%hu %lf %lf", &room_id, &min_temp, &max_temp) != 3) continue;
+            for (sensor_t *sensor = dph_iter_first(sensor_map, &iter); sensor != NULL; sensor = dph_iter_next(&iter))
             {
-                temp += sensor->temperatures[i];
+                if (sensor->room_id == room_id)
+                {
+                    sensor->min_temp = min_temp;
+                    sensor->max_temp = max_temp;
+                }
             }
-            double running_avg = temp/RUN_AVG_LENGTH;
-            return running_avg;
         }
+        fclose(fp);
+    }
+
+    //per sensor limits
+    rewind(fp_sensor_map);
+    while (fgets(line, sizeof(line), fp_sensor_map) != NULL)
+    {
+        if (sscanf(line, "%hu %hu %lf %lf", &room_id, &sensor_id, &min_temp, &max_temp) != 4) continue;
+        sensor_t * dummy = dph_get_int(sensor_map, sensor_id);
+        if (dummy == NULL) continue;
+        dummy->min_temp = min_temp;
+        dummy->max_temp = max_temp;
+    }
+
+    for (sensor_t *sensor = dph_iter_first(sensor_map, &iter); sensor != NULL; sensor = dph_iter_next(&iter))
+    {
+        sensor_publish(sensor, sensor->published.running_avg);
     }
-    ERROR_HANDLER(true, "Wrong sensor data"); //if we get this far, the sensor has not been found
 }
 
-time_t datamgr_get_last_modified(sensor_id_t sensor_id)
+/*
+ * Seqlock writer side, only the datamgr thread writes so no lock is needed between writers
+ */
+static void sensor_publish(sensor_t *sensor, sensor_value_t running_avg)
 {
-    for (int i = 0; i < dpl_size(sensor_list); i++)
+    unsigned int seq = atomic_load_explicit(&sensor->seq, memory_order_relaxed);
+    atomic_store_explicit(&sensor->seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    sensor->published.room_id = sensor->room_id;
+    sensor->published.running_avg = running_avg;
+    sensor->published.last_modified = sensor->last_modified;
+    sensor->published.min_temp = sensor->min_temp;
+    sensor->published.max_temp = sensor->max_temp;
+    sensor->published.alert = sensor->alert;
+    sensor->published.late_readings = sensor->late_readings;
+    atomic_store_explicit(&sensor->seq, seq + 2, memory_order_release);
+}
+
+/*
+ * Compares the modification times of SENSOR_MAP_FILE and THRESHOLD_FILE with the ones seen at the previous call,
+ * for the map file also the inode, so a replacement with the same mtime is noticed as well
+ */
+static bool datamgr_thresholds_changed()
+{
+    static time_t map_mtime = 0, threshold_mtime = 0;
+    static ino_t map_ino = 0;
+    struct stat st;
+    bool changed = false;
+
+    if (stat(SENSOR_MAP_FILE, &st) == 0 && (st.st_mtime != map_mtime || st.st_ino != map_ino))
     {
-        sensor_t * sensor = (sensor_t *)(dpl_get_element_at_index(sensor_list,i));
-        if (sensor->sensor_id == sensor_id)
-        {
-            return sensor->last_modified;
-        }
+        map_mtime = st.st_mtime;
+        map_ino = st.st_ino;
+        changed = true;
+    }
+    time_t mtime = (stat(THRESHOLD_FILE, &st) == 0) ? st.st_mtime : 0;
+    if (mtime != threshold_mtime)
+    {
+        threshold_mtime = mtime;
+        changed = true;
     }
-    ERROR_HANDLER(true, "Wrong sensor data"); //if we get this far, the sensor has not been found
+    return changed;
+}
+
+void datamgr_free()
+{
+    dph_free(&sensor_map, true);
+}
+
+int datamgr_get_snapshot(sensor_id_t sensor_id, sensor_snapshot_t *snapshot)
+{
+    sensor_t *sensor = dph_get_int(sensor_map, sensor_id);
+    if (sensor == NULL) return -1;
+
+    unsigned int begin, end;
+    do
+    {
+        begin = atomic_load_explicit(&sensor->seq, memory_order_acquire);
+        *snapshot = sensor->published;
+        atomic_thread_fence(memory_order_acquire);
+        end = atomic_load_explicit(&sensor->seq, memory_order_relaxed);
+    } while ((begin & 1) || begin != end);
+    return 0;
+}
+
+uint16_t datamgr_get_room_id(sensor_id_t sensor_id)
+{
+    sensor_snapshot_t snapshot;
+    ERROR_HANDLER(datamgr_get_snapshot(sensor_id, &snapshot) != 0, "Wrong sensor data");
+    return snapshot.room_id;
+}
+
+sensor_value_t datamgr_get_avg(sensor_id_t sensor_id)
+{
+    sensor_snapshot_t snapshot;
+    ERROR_HANDLER(datamgr_get_snapshot(sensor_id, &snapshot) != 0, "Wrong sensor data");
+    return snapshot.running_avg;
+}
+
+time_t datamgr_get_last_modified(sensor_id_t sensor_id)
+{
+    sensor_snapshot_t snapshot;
+    ERROR_HANDLER(datamgr_get_snapshot(sensor_id, &snapshot) != 0, "Wrong sensor data");
+    return snapshot.last_modified;
+}
+
+void datamgr_get_thresholds(sensor_id_t sensor_id, sensor_value_t *min_temp, sensor_value_t *max_temp)
+{
+    sensor_snapshot_t snapshot;
+    ERROR_HANDLER(datamgr_get_snapshot(sensor_id, &snapshot) != 0, "Wrong sensor data");
+    *min_temp = snapshot.min_temp;
+    *max_temp = snapshot.max_temp;
+}
+
+alert_state_t datamgr_get_alert_state(sensor_id_t sensor_id)
+{
+    sensor_snapshot_t snapshot;
+    ERROR_HANDLER(datamgr_get_snapshot(sensor_id, &snapshot) != 0, "Wrong sensor data");
+    return snapshot.alert;
 }
 
 int datamgr_get_total_sensors()
 {
-    return dpl_size(sensor_list);
+    return dph_size(sensor_map);
 }
 
 void * sensor_copy(void * sensor)
@@ -175,18 +439,15 @@ void * sensor_copy(void * sensor)
     dummy->sensor_id = ((sensor_t*)sensor)->sensor_id;
     dummy->room_id = ((sensor_t*)sensor)->room_id;
     *dummy->temperatures = *((sensor_t*)sensor)->temperatures;
+    dummy->anomaly = anomaly_create();
     return dummy;
 }
 
 void sensor_free(void **sensor)
 {
+    if (((sensor_t*)*sensor)->anomaly != NULL) anomaly_free(&((sensor_t*)*sensor)->anomaly);
     free(*sensor);
     *sensor = NULL;
 }
 
-int sensor_compare(void *x, void *y)
-{
-    if(((sensor_t*)x)->sensor_id == ((sensor_t*)y)->sensor_id) return 0;
-    else return 1;
-}
 
@@ -15,14 +15,89 @@
 #define RUN_AVG_LENGTH 5
 #endif
 
+/*
+ * SET_MAX_TEMP and SET_MIN_TEMP are only the defaults, limits can be overridden per sensor with 2 extra
+ * columns in the map file ("room_id sensor_id min max") or per room in THRESHOLD_FILE ("room_id min max")
+ * A per sensor limit wins over a per room limit
+ */
 #ifndef SET_MAX_TEMP
-#error SET_MAX_TEMP not set
+#define SET_MAX_TEMP 20
 #endif
 
 #ifndef SET_MIN_TEMP
-#error SET_MIN_TEMP not set
+#define SET_MIN_TEMP 10
+#endif
+
+#ifndef THRESHOLD_FILE
+#define THRESHOLD_FILE "room_threshold.map"
+#endif
+
+/*
+ * The map file ("room_id sensor_id [min max]"), reopened by path when it changes so a replaced file is picked up
+ */
+#ifndef SENSOR_MAP_FILE
+#define SENSOR_MAP_FILE "room_sensor.map"
+#endif
+
+/*
+ * Interval (in sec) at which the map file and THRESHOLD_FILE are checked for changes, changed limits are reloaded
+ */
+#ifndef THRESHOLD_RELOAD
+#define THRESHOLD_RELOAD 1
+#endif
+
+/*
+ * Alert hysteresis: a sensor enters the "too hot" state above SET_MAX_TEMP but only leaves it again
+ * once the running avg drops below SET_MAX_TEMP - ALERT_HYSTERESIS (mirrored for "too cold")
+ */
+#ifndef ALERT_HYSTERESIS
+#define ALERT_HYSTERESIS 0.5
+#endif
+
+/*
+ * Minimum time (in sec, measured on the reading timestamps) a new alert state has to persist before it is reported
+ */
+#ifndef ALERT_DWELL
+#define ALERT_DWELL 0
+#endif
+
+/*
+ * Interval (in sec) at which a still active alert is reported again, 0 disables the reminder
+ */
+#ifndef ALERT_REMINDER
+#define ALERT_REMINDER 0
 #endif
 
+/*
+ * Readings of a sensor are held back for REORDER_WINDOW sec (measured on the reading timestamps) and applied
+ * in timestamp order, readings older than the last applied reading are counted as late and left out of the stats
+ * At most REORDER_SLOTS readings are held back per sensor, when the window is full the oldest one is applied early
+ */
+#ifndef REORDER_WINDOW
+#define REORDER_WINDOW 2
+#endif
+
+#ifndef REORDER_SLOTS
+#define REORDER_SLOTS 16
+#endif
+
+typedef enum {
+    ALERT_NORMAL, ALERT_TOO_COLD, ALERT_TOO_HOT
+} alert_state_t;
+
+/*
+ * Consistent copy of the state the datamgr publishes for a sensor
+ */
+typedef struct {
+    room_id_t room_id;
+    sensor_value_t running_avg;     /**< 0 if less then RUN_AVG_LENGTH measurements are recorded */
+    sensor_ts_t last_modified;
+    sensor_value_t min_temp;
+    sensor_value_t max_temp;
+    alert_state_t alert;
+    unsigned int late_readings;     /**< readings that arrived after the reorder window passed them */
+} sensor_snapshot_t;
+
 /*
  * Use ERROR_HANDLER() for handling memory allocation problems, invalid sensor IDs, non-existing files, etc.
  */
@@ -47,6 +122,16 @@ void datamgr_parse_from_buffer(FILE *fp_sensor_map, sbuffer_t * sbuffer, int dat
  */
 void datamgr_free();
 
+/**
+ * Takes a consistent snapshot of the published state of a certain sensor ID
+ * Safe to call from any thread while the datamgr is running: readers never block the datamgr, they retry
+ * when an update happened while they were copying
+ * \param sensor_id the sensor id to look for
+ * \param snapshot will be filled out with the published state
+ * \return 0 on success, -1 if sensor_id is invalid
+ */
+int datamgr_get_snapshot(sensor_id_t sensor_id, sensor_snapshot_t *snapshot);
+
 /**
  * Gets the room ID for a certain sensor ID
  * Use ERROR_HANDLER() if sensor_id is invalid
@@ -71,6 +156,23 @@ sensor_value_t datamgr_get_avg(sensor_id_t sensor_id);
  */
 time_t datamgr_get_last_modified(sensor_id_t sensor_id);
 
+/**
+ * Gets the temperature limits currently in use for a certain sensor ID
+ * Use ERROR_HANDLER() if sensor_id is invalid
+ * \param sensor_id the sensor id to look for
+ * \param min_temp will be filled out with the lower limit
+ * \param max_temp will be filled out with the upper limit
+ */
+void datamgr_get_thresholds(sensor_id_t sensor_id, sensor_value_t *min_temp, sensor_value_t *max_temp);
+
+/**
+ * Returns the alert state that was last reported for a certain sensor ID
+ * Use ERROR_HANDLER() if sensor_id is invalid
+ * \param sensor_id the sensor id to look for
+ * \return ALERT_NORMAL, ALERT_TOO_COLD or ALERT_TOO_HOT
+ */
+alert_state_t datamgr_get_alert_state(sensor_id_t sensor_id);
+
 /**
  *  Return the total amount of unique sensor ID's recorded by the datamgr
  *  \return the total amount of sensors
@@ -0,0 +1,117 @@
+/**
+ * \author Koen Eelen
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "logger.h"
+
+#define MAX_SENSOR_FILTERS 32
+
+/*
+ * Renders the binary event log of the gateway as the text log:
+ *  gateway_logdump [-t type]... [-s sensor id]... [file]...
+ * The files are dumped in the given order, so pass rotated files oldest first (gateway.events.2 gateway.events.1 gateway.events)
+ * Only events of one of the given types and about one of the given sensors are printed, all events without filters
+ */
+
+static void print_usage(const char *name)
+{
+    printf("Usage: %s [-t type]... [-s sensor id]... [file]...\n", name);
+    printf("The default file is %s, types:", LOG_FILE);
+    for (int i = 0; i < LOG_EVENT_COUNT; i++) printf(" %s", logger_event_name(i));
+    printf("\n");
+}
+
+/*
+ * Prints the events of one log file that pass the filters, 'types' is a bitmask of log_event_type_t (0: all types)
+ */
+static int dump_file(const char *path, unsigned long types, const int *sensors, int sensor_count)
+{
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL)
+    {
+        printf("Error: can't open %s.\n", path);
+        return EXIT_FAILURE;
+    }
+    log_file_header_t header;
+    if (fread(&header, sizeof(header), 1, fp) != 1 || header.magic != LOG_MAGIC)
+    {
+        printf("Error: %s is not a gateway event log.\n", path);
+        fclose(fp);
+        return EXIT_FAILURE;
+    }
+    if (header.version != LOG_VERSION || header.record_size != sizeof(log_event_t))
+    {
+        printf("Error: %s has version %d with %d byte records, expected version %d with %zu byte records.\n",
+               path, header.version, header.record_size, LOG_VERSION, sizeof(log_event_t));
+        fclose(fp);
+        return EXIT_FAILURE;
+    }
+
+    log_event_t event;
+    char line[256];
+    while (fread(&event, sizeof(event), 1, fp) == 1)
+    {
+        if (types != 0 && (event.type >= LOG_EVENT_COUNT || !(types & (1UL << event.type)))) continue;
+        if (sensor_count > 0)
+        {
+            bool match = false;
+            for (int i = 0; i < sensor_count && !match; i++) match = event.sensor_id == sensors[i];
+            if (!match) continue;
+        }
+        logger_format_event(&event, line, sizeof(line));
+        printf("%s\n", line);
+    }
+    fclose(fp);
+    return EXIT_SUCCESS;
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned long types = 0;
+    int sensors[MAX_SENSOR_FILTERS];
+    int sensor_count = 0;
+    int option;
+
+    while ((option = getopt(argc, argv, "t:s:h")) != -1)
+    {
+        switch (option)
+        {
+            case 't':
+            {
+                int type = 0;
+                while (type < LOG_EVENT_COUNT && strcmp(logger_event_name(type), optarg) != 0) type++;
+                if (type == LOG_EVENT_COUNT)
+                {
+                    printf("Error: unknown event type %s.\n", optarg);
+                    print_usage(argv[0]);
+                    exit(EXIT_FAILURE);
+                }
+                types |= 1UL << type;
+                break;
+            }
+            case 's':
+                if (sensor_count == MAX_SENSOR_FILTERS)
+                {
+                    printf("Error: at most %d sensor ids.\n", MAX_SENSOR_FILTERS);
+                    exit(EXIT_FAILURE);
+                }
+                sensors[sensor_count++] = atoi(optarg);
+                break;
+            default:
+                print_usage(argv[0]);
+                exit(option == 'h' ? EXIT_SUCCESS : EXIT_FAILURE);
+        }
+    }
+
+    int result = EXIT_SUCCESS;
+    if (optind == argc) return dump_file(LOG_FILE, types, sensors, sensor_count);
+    for (int i = optind; i < argc; i++)
+    {
+        if (dump_file(argv[i], types, sensors, sensor_count) != EXIT_SUCCESS) result = EXIT_FAILURE;
+    }
+    return result;
+}
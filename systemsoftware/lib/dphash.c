@@ -0,0 +1,407 @@
+/**
+ * \author Koen Eelen
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <assert.h>
+#include "dphash.h"
+
+/*
+ * definition of error codes
+ * */
+#define DPHASH_NO_ERROR 0
+#define DPHASH_MEMORY_ERROR 1 // error due to mem alloc failure
+#define DPHASH_INVALID_ERROR 2 //error due to a map operation applied on the wrong kind of map
+
+#ifdef DEBUG
+#define DEBUG_PRINTF(...) 									                                        \
+        do {											                                            \
+            fprintf(stderr,"\nIn %s - function %s at line %d: ", __FILE__, __func__, __LINE__);	    \
+            fprintf(stderr,__VA_ARGS__);								                            \
+            fflush(stderr);                                                                         \
+                } while(0)
+#else
+#define DEBUG_PRINTF(...) (void)0
+#endif
+
+
+#define DPHASH_ERR_HANDLER(condition, err_code)                         \
+    do {                                                                \
+            if ((condition)) DEBUG_PRINTF(#condition " failed\n");      \
+            assert(!(condition));                                       \
+        } while(0)
+
+
+/*
+ * The real definition of struct dphash
+ */
+
+typedef struct {
+    uint64_t key;               /**< the integer key, or the hash of the element */
+    void *element;
+    uint32_t distance;          /**< 1 + the distance from the home slot of 'key', 0 for an empty slot */
+} dphash_slot_t;
+
+typedef struct {
+    dphash_slot_t *slots;       /**< NULL for the old table when the map isn't growing */
+    size_t capacity;            /**< a power of 2 */
+    size_t count;
+} dphash_table_t;
+
+struct dphash {
+    dphash_table_t table;       /**< new elements always go here */
+    dphash_table_t old;         /**< while growing: the previous table, emptied from 'migrate_pos' on */
+    size_t migrate_pos;
+    bool int_keys;
+
+    void *(*element_copy)(void *src_element);
+
+    void (*element_free)(void **element);
+
+    int (*element_compare)(void *x, void *y);
+
+    uint64_t (*element_hash)(void *element);
+};
+
+/*
+ * Spreads the bits of a key over the whole word (splitmix64 finalizer), so sequential ids and fds don't cluster
+ */
+static inline size_t dph_home(dphash_table_t *table, uint64_t key)
+{
+    key ^= key >> 30;
+    key *= 0xbf58476d1ce4e5b9ULL;
+    key ^= key >> 27;
+    key *= 0x94d049bb133111ebULL;
+    key ^= key >> 31;
+    return key & (table->capacity - 1);
+}
+
+static void dph_table_init(dphash_table_t *table, size_t capacity)
+{
+    table->slots = calloc(capacity, sizeof(dphash_slot_t));
+    DPHASH_ERR_HANDLER(table->slots == NULL, DPHASH_MEMORY_ERROR);
+    table->capacity = capacity;
+    table->count = 0;
+}
+
+/*
+ * Robin Hood insert: an element that is further from its home slot than the one it meets takes that slot,
+ * and the displaced element continues the probe
+ */
+static void dph_table_place(dphash_table_t *table, uint64_t key, void *element)
+{
+    size_t mask = table->capacity - 1;
+    size_t i = dph_home(table, key);
+    dphash_slot_t insert = {key, element, 1};
+
+    while (table->slots[i].distance != 0)
+    {
+        if (table->slots[i].distance < insert.distance)
+        {
+            dphash_slot_t displaced = table->slots[i];
+            table->slots[i] = insert;
+            insert = displaced;
+        }
+        i = (i + 1) & mask;
+        insert.distance++;
+    }
+    table->slots[i] = insert;
+    table->count++;
+}
+
+/*
+ * Stops at the first slot that is closer to its home than 'key' would be: 'key' would have taken that slot
+ */
+static dphash_slot_t *dph_table_find(dphash_t *map, dphash_table_t *table, uint64_t key, void *element)
+{
+    if (table->slots == NULL) return NULL;
+    size_t mask = table->capacity - 1;
+    size_t i = dph_home(table, key);
+
+    for (uint32_t distance = 1; table->slots[i].distance >= distance; distance++)
+    {
+        dphash_slot_t *slot = &table->slots[i];
+        if (slot->key == key && (map->int_keys || map->element_compare(slot->element, element) == 0)) return slot;
+        i = (i + 1) & mask;
+    }
+    return NULL;
+}
+
+/*
+ * Backward shift deletion: the rest of the probe sequence moves one slot closer to home, no tombstones needed.
+ * Only slots after 'index' move, so a scan in index order that stays on 'index' still sees every element once.
+ */
+static void dph_table_erase(dphash_table_t *table, size_t index)
+{
+    size_t mask = table->capacity - 1;
+    size_t next = (index + 1) & mask;
+
+    while (table->slots[next].distance > 1)
+    {
+        table->slots[index] = table->slots[next];
+        table->slots[index].distance--;
+        index = next;
+        next = (next + 1) & mask;
+    }
+    table->slots[index].distance = 0;
+    table->slots[index].element = NULL;
+    table->count--;
+}
+
+/*
+ * Moves up to 'steps' slots of the old table to the new one, and frees the old table once it's empty
+ */
+static void dph_migrate(dphash_t *map, size_t steps)
+{
+    while (map->old.slots != NULL && steps-- > 0)
+    {
+        dphash_slot_t *slot = &map->old.slots[map->migrate_pos];
+        if (slot->distance != 0)
+        {
+            dph_table_place(&map->table, slot->key, slot->element);
+            dph_table_erase(&map->old, map->migrate_pos);
+        }
+        else if (++map->migrate_pos == map->old.capacity)
+        {
+            free(map->old.slots);
+            map->old.slots = NULL;
+            map->old.count = 0;
+        }
+    }
+}
+
+/*
+ * Starts growing the map if one more element would pass DPHASH_MAX_LOAD, a previous growth is finished first
+ */
+static void dph_reserve(dphash_t *map)
+{
+    size_t count = map->table.count + map->old.count + 1;
+    if (count * 100 <= map->table.capacity * DPHASH_MAX_LOAD) return;
+
+    dph_migrate(map, SIZE_MAX);
+    map->old = map->table;
+    map->migrate_pos = 0;
+    dph_table_init(&map->table, map->old.capacity * 2);
+}
+
+static dphash_slot_t *dph_find(dphash_t *map, uint64_t key, void *element, dphash_table_t **table)
+{
+    dphash_slot_t *slot = dph_table_find(map, &map->table, key, element);
+    *table = &map->table;
+    if (slot == NULL)
+    {
+        slot = dph_table_find(map, &map->old, key, element);
+        *table = &map->old;
+    }
+    return slot;
+}
+
+static dphash_t *dph_create_map(
+        void *(*element_copy)(void *src_element),
+        void (*element_free)(void **element),
+        int (*element_compare)(void *x, void *y),
+        uint64_t (*element_hash)(void *element),
+        bool int_keys
+) {
+    dphash_t *map = malloc(sizeof(struct dphash));
+    DPHASH_ERR_HANDLER(map == NULL, DPHASH_MEMORY_ERROR);
+    dph_table_init(&map->table, DPHASH_MIN_CAPACITY);
+    map->old.slots = NULL;
+    map->old.capacity = 0;
+    map->old.count = 0;
+    map->migrate_pos = 0;
+    map->int_keys = int_keys;
+    map->element_copy = element_copy;
+    map->element_free = element_free;
+    map->element_compare = element_compare;
+    map->element_hash = element_hash;
+    return map;
+}
+
+dphash_t *dph_create(
+        void *(*element_copy)(void *src_element),
+        void (*element_free)(void **element),
+        int (*element_compare)(void *x, void *y),
+        uint64_t (*element_hash)(void *element)
+) {
+    return dph_create_map(element_copy, element_free, element_compare, element_hash, false);
+}
+
+dphash_t *dph_create_int(
+        void *(*element_copy)(void *src_element),
+        void (*element_free)(void **element)
+) {
+    return dph_create_map(element_copy, element_free, NULL, NULL, true);
+}
+
+static void dph_free_table(dphash_t *map, dphash_table_t *table, bool free_element)
+{
+    if (table->slots == NULL) return;
+    for (size_t i = 0; i < table->capacity && free_element; i++)
+    {
+        if (table->slots[i].distance != 0) map->element_free(&table->slots[i].element);
+    }
+    free(table->slots);
+    table->slots = NULL;
+}
+
+void dph_free(dphash_t **map, bool free_element)
+{
+    if (map == NULL || *map == NULL) return;
+    dph_free_table(*map, &(*map)->table, free_element);
+    dph_free_table(*map, &(*map)->old, free_element);
+    free(*map);
+    *map = NULL;
+}
+
+int dph_size(dphash_t *map)
+{
+    if (map == NULL) return -1;
+    return map->table.count + map->old.count;
+}
+
+static dphash_t *dph_insert_key(dphash_t *map, uint64_t key, void *element, bool insert_copy)
+{
+    dphash_table_t *table;
+    if (dph_find(map, key, element, &table) != NULL) return map;
+
+    dph_reserve(map);
+    dph_table_place(&map->table, key, insert_copy ? map->element_copy(element) : element);
+    dph_migrate(map, DPHASH_MIGRATE_STEP);
+    return map;
+}
+
+static dphash_t *dph_remove_key(dphash_t *map, uint64_t key, void *element, bool free_element)
+{
+    dphash_table_t *table;
+    dphash_slot_t *slot = dph_find(map, key, element, &table);
+    if (slot == NULL) return map;
+
+    if (free_element) map->element_free(&slot->element);
+    dph_table_erase(table, slot - table->slots);
+    dph_migrate(map, DPHASH_MIGRATE_STEP);
+    return map;
+}
+
+dphash_t *dph_insert(dphash_t *map, void *element, bool insert_copy)
+{
+    if (map == NULL) return NULL;
+    DPHASH_ERR_HANDLER(map->int_keys, DPHASH_INVALID_ERROR);
+    return dph_insert_key(map, map->element_hash(element), element, insert_copy);
+}
+
+void *dph_get(dphash_t *map, void *element)
+{
+    if (map == NULL) return NULL;
+    DPHASH_ERR_HANDLER(map->int_keys, DPHASH_INVALID_ERROR);
+    dphash_table_t *table;
+    dphash_slot_t *slot = dph_find(map, map->element_hash(element), element, &table);
+    return slot != NULL ? slot->element : NULL;
+}
+
+dphash_t *dph_remove(dphash_t *map, void *element, bool free_element)
+{
+    if (map == NULL) return NULL;
+    DPHASH_ERR_HANDLER(map->int_keys, DPHASH_INVALID_ERROR);
+    return dph_remove_key(map, map->element_hash(element), element, free_element);
+}
+
+dphash_t *dph_insert_int(dphash_t *map, int64_t key, void *element, bool insert_copy)
+{
+    if (map == NULL) return NULL;
+    DPHASH_ERR_HANDLER(!map->int_keys, DPHASH_INVALID_ERROR);
+    return dph_insert_key(map, (uint64_t)key, element, insert_copy);
+}
+
+void *dph_get_int(dphash_t *map, int64_t key)
+{
+    if (map == NULL) return NULL;
+    DPHASH_ERR_HANDLER(!map->int_keys, DPHASH_INVALID_ERROR);
+    dphash_table_t *table;
+    dphash_slot_t *slot = dph_find(map, (uint64_t)key, NULL, &table);
+    return slot != NULL ? slot->element : NULL;
+}
+
+dphash_t *dph_remove_int(dphash_t *map, int64_t key, bool free_element)
+{
+    if (map == NULL) return NULL;
+    DPHASH_ERR_HANDLER(!map->int_keys, DPHASH_INVALID_ERROR);
+    return dph_remove_key(map, (uint64_t)key, NULL, free_element);
+}
+
+static dphash_table_t *dph_iter_table(dphash_iter_t *iter)
+{
+    return iter->table == 0 ? &iter->map->table : &iter->map->old;
+}
+
+/*
+ * A table is scanned once around, starting at an empty slot: an erase only shifts the elements after the
+ * erased slot, up to the next empty slot, so dph_iter_remove() can't move an element the scan has passed already
+ */
+static void dph_iter_start(dphash_iter_t *iter, int table)
+{
+    dphash_table_t *t;
+    iter->table = table;
+    t = dph_iter_table(iter);
+    iter->index = 0;
+    iter->remaining = 0;
+    iter->removed = false;
+    if (t->slots == NULL || t->count == 0) return;
+    while (t->slots[iter->index].distance != 0) iter->index++;
+    iter->remaining = t->capacity;
+}
+
+static void *dph_iter_seek(dphash_iter_t *iter)
+{
+    while (true)
+    {
+        dphash_table_t *t = dph_iter_table(iter);
+        while (iter->remaining > 0)
+        {
+            if (t->slots[iter->index].distance != 0) return t->slots[iter->index].element;
+            iter->index = (iter->index + 1) & (t->capacity - 1);
+            iter->remaining--;
+        }
+        if (iter->table == 1) return NULL;
+        dph_iter_start(iter, 1);
+    }
+}
+
+void *dph_iter_first(dphash_t *map, dphash_iter_t *iter)
+{
+    iter->map = map;
+    if (map == NULL)
+    {
+        iter->table = 1;
+        iter->remaining = 0;
+        iter->removed = false;
+        return NULL;
+    }
+    dph_iter_start(iter, 0);
+    return dph_iter_seek(iter);
+}
+
+void *dph_iter_next(dphash_iter_t *iter)
+{
+    if (iter->map == NULL) return NULL;
+    if (!iter->removed && iter->remaining > 0)
+    {
+        iter->index = (iter->index + 1) & (dph_iter_table(iter)->capacity - 1);
+        iter->remaining--;
+    }
+    iter->removed = false;
+    return dph_iter_seek(iter);
+}
+
+void dph_iter_remove(dphash_iter_t *iter, bool free_element)
+{
+    if (iter->map == NULL || iter->removed || iter->remaining == 0) return;
+    dphash_table_t *t = dph_iter_table(iter);
+    dphash_slot_t *slot = &t->slots[iter->index];
+    if (slot->distance == 0) return;
+
+    if (free_element) iter->map->element_free(&slot->element);
+    dph_table_erase(t, iter->index);
+    iter->removed = true;
+}
@@ -0,0 +1,174 @@
+/**
+ * \author Koen Eelen
+ */
+
+#ifndef _DPHASH_H_
+#define _DPHASH_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "dplist.h"
+
+/*
+ * Capacity (in slots) of a new map, must be a power of 2
+ */
+#ifndef DPHASH_MIN_CAPACITY
+#define DPHASH_MIN_CAPACITY 16
+#endif
+
+/*
+ * A map grows to twice its capacity once more than DPHASH_MAX_LOAD percent of the slots would be in use
+ */
+#ifndef DPHASH_MAX_LOAD
+#define DPHASH_MAX_LOAD 75
+#endif
+
+/*
+ * While a map grows, every insert and remove moves DPHASH_MIGRATE_STEP slots of the old table to the new one,
+ * so no single operation pays for the whole rehash
+ */
+#ifndef DPHASH_MIGRATE_STEP
+#define DPHASH_MIGRATE_STEP 8
+#endif
+
+/**
+ * dphash_t is an open addressing hash map (Robin Hood probing, backward shift deletion)
+ */
+typedef struct dphash dphash_t;
+
+/**
+ * Cursor over a map, see dph_iter_first(). Lives on the stack of the caller, the fields are private.
+ */
+typedef struct {
+    dphash_t *map;
+    int table;                  /**< 0: the current table, 1: the table that is being migrated */
+    size_t index;
+    size_t remaining;           /**< slots of 'table' that still have to be visited */
+    bool removed;               /**< the element at 'index' was removed, another one may have shifted into its slot */
+} dphash_iter_t;
+
+/* General remark on error handling
+ * All functions below will:
+ * - use assert() to check if memory allocation was successfully.
+ * - use assert() to check that the functions of the right kind of map (dph_create() or dph_create_int()) are used.
+ */
+
+/** Create and allocate memory for a new map, the elements are their own keys
+ * \param element_copy callback function to duplicate 'element'; If needed allocated new memory for the duplicated element.
+ * \param element_free callback function to free memory allocated to element
+ * \param element_compare callback function to compare two elements; returns 0 if x==y
+ * \param element_hash callback function to hash an element; equal elements must have equal hashes
+ * \return a pointer to a newly-allocated and initialized map.
+ */
+dphash_t *dph_create(
+        void *(*element_copy)(void *element),
+        void (*element_free)(void **element),
+        int (*element_compare)(void *x, void *y),
+        uint64_t (*element_hash)(void *element)
+);
+
+/** Create and allocate memory for a new map with integer keys
+ * - The keys are stored in the slots themselves, so lookups never call back or follow an element pointer.
+ * \param element_copy callback function to duplicate 'element'; If needed allocated new memory for the duplicated element.
+ * \param element_free callback function to free memory allocated to element
+ * \return a pointer to a newly-allocated and initialized map.
+ */
+dphash_t *dph_create_int(
+        void *(*element_copy)(void *element),
+        void (*element_free)(void **element)
+);
+
+/** Deletes all elements in the map and the map itself
+ * - '*map' must be set to NULL.
+ * \param map a double pointer to the map
+ * \param free_element if true call element_free() on every element
+ */
+void dph_free(dphash_t **map, bool free_element);
+
+/** Returns the number of elements in the map, in O(1).
+ * - If 'map' is is NULL, -1 is returned.
+ * \param map a pointer to the map
+ * \return the size of the map
+ */
+int dph_size(dphash_t *map);
+
+/** Inserts 'element' in a map made by dph_create()
+ * - If the map already contains an element equal to 'element', nothing is inserted.
+ * - If 'map' is is NULL, NULL is returned.
+ * \param map a pointer to the map
+ * \param element a pointer to the data that needs to be inserted
+ * \param insert_copy if true use element_copy() to make a copy of 'element' and store the copy, otherwise the given element pointer is stored
+ * \return a pointer to the map or NULL
+ */
+dphash_t *dph_insert(dphash_t *map, void *element, bool insert_copy);
+
+/** Returns the element in a map made by dph_create() that is equal to 'element'
+ * - If 'map' is NULL or no such element is found, NULL is returned.
+ * \param map a pointer to the map
+ * \param element a pointer to an element to compare with
+ * \return the element in the map or NULL
+ */
+void *dph_get(dphash_t *map, void *element);
+
+/** Removes the element equal to 'element' from a map made by dph_create()
+ * - If 'map' is NULL or no such element is found, nothing is done.
+ * \param map a pointer to the map
+ * \param element a pointer to an element to compare with
+ * \param free_element if true call element_free() on the removed element
+ * \return a pointer to the map or NULL
+ */
+dphash_t *dph_remove(dphash_t *map, void *element, bool free_element);
+
+/** Inserts 'element' under 'key' in a map made by dph_create_int()
+ * - If the map already contains 'key', nothing is inserted.
+ * - If 'map' is is NULL, NULL is returned.
+ * \param map a pointer to the map
+ * \param key the key of the element
+ * \param element a pointer to the data that needs to be inserted
+ * \param insert_copy if true use element_copy() to make a copy of 'element' and store the copy, otherwise the given element pointer is stored
+ * \return a pointer to the map or NULL
+ */
+dphash_t *dph_insert_int(dphash_t *map, int64_t key, void *element, bool insert_copy);
+
+/** Returns the element stored under 'key' in a map made by dph_create_int()
+ * - If 'map' is NULL or 'key' is not found, NULL is returned.
+ * \param map a pointer to the map
+ * \param key the key to look for
+ * \return the element in the map or NULL
+ */
+void *dph_get_int(dphash_t *map, int64_t key);
+
+/** Removes the element stored under 'key' from a map made by dph_create_int()
+ * - If 'map' is NULL or 'key' is not found, nothing is done.
+ * \param map a pointer to the map
+ * \param key the key of the element to remove
+ * \param free_element if true call element_free() on the removed element
+ * \return a pointer to the map or NULL
+ */
+dphash_t *dph_remove_int(dphash_t *map, int64_t key, bool free_element);
+
+/** Starts iterating over the map, in no particular order:
+ *      for (elem = dph_iter_first(map, &iter); elem != NULL; elem = dph_iter_next(&iter))
+ * - Every element is visited exactly once, also while the map grows.
+ * - The map must not be changed during the iteration, other than by dph_iter_remove().
+ * - If 'map' is NULL or empty, NULL is returned.
+ * \param map a pointer to the map
+ * \param iter the cursor to initialize
+ * \return the first element or NULL
+ */
+void *dph_iter_first(dphash_t *map, dphash_iter_t *iter);
+
+/** Moves the cursor to the next element.
+ * \param iter the cursor
+ * \return the next element, or NULL when all elements were visited
+ */
+void *dph_iter_next(dphash_iter_t *iter);
+
+/** Removes the element at the cursor, the next dph_iter_next() continues with the elements not visited yet.
+ * - If the cursor is at the end of the map or its element was removed already, nothing is done.
+ * \param iter the cursor
+ * \param free_element if true call element_free() on the removed element
+ */
+void dph_iter_remove(dphash_iter_t *iter, bool free_element);
+
+#endif  // _DPHASH_H_
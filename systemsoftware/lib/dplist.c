@@ -44,6 +44,8 @@ struct dplist_node {
 
 struct dplist {
     dplist_node_t *head;
+    dplist_node_t *tail;
+    int size;                   /**< kept up to date by every insert and remove, so dpl_size() is O(1) */
 
     void *(*element_copy)(void *src_element);
 
@@ -61,6 +63,8 @@ dplist_t *dpl_create(// callback functions
     list = malloc(sizeof(struct dplist));
     DPLIST_ERR_HANDLER(list == NULL, DPLIST_MEMORY_ERROR);
     list->head = NULL;
+    list->tail = NULL;
+    list->size = 0;
     list->element_copy = element_copy;
     list->element_free = element_free;
     list->element_compare = element_compare;
@@ -81,102 +85,81 @@ void dpl_free(dplist_t **list, bool free_element) {
     *list = NULL;
 }
 
-dplist_t *dpl_insert_at_index(dplist_t *list, void *element, int index, bool insert_copy) {
-    dplist_node_t *ref_at_index, *list_node;
-    if (list == NULL) return NULL;
-    list_node = malloc(sizeof(dplist_node_t));
+/*
+ * Links 'list_node' in before 'reference', or at the end of the list if 'reference' is NULL
+ */
+static void dpl_link_before(dplist_t *list, dplist_node_t *list_node, dplist_node_t *reference) {
+    if (reference == NULL) {
+        list_node->prev = list->tail;
+        list_node->next = NULL;
+        if (list->tail != NULL) list->tail->next = list_node;
+        else list->head = list_node;
+        list->tail = list_node;
+    } else {
+        list_node->prev = reference->prev;
+        list_node->next = reference;
+        if (reference->prev != NULL) reference->prev->next = list_node;
+        else list->head = list_node;
+        reference->prev = list_node;
+    }
+    list->size++;
+}
+
+/*
+ * Unlinks 'reference' from the list and frees the list node, and its element if 'free_element' is true
+ */
+static void dpl_unlink(dplist_t *list, dplist_node_t *reference, bool free_element) {
+    if (reference->prev != NULL) reference->prev->next = reference->next;
+    else list->head = reference->next;
+    if (reference->next != NULL) reference->next->prev = reference->prev;
+    else list->tail = reference->prev;
+    list->size--;
+    if (free_element) list->element_free(&(reference->element));
+    free(reference);
+}
+
+static dplist_node_t *dpl_new_node(dplist_t *list, void *element, bool insert_copy) {
+    dplist_node_t *list_node = malloc(sizeof(dplist_node_t));
     DPLIST_ERR_HANDLER(list_node == NULL, DPLIST_MEMORY_ERROR);
     if (insert_copy) (list_node->element) = list->element_copy(element);
     else list_node->element = element;
-    // pointer drawing breakpoint
-    if (list->head == NULL) { // covers case 1
-        list_node->prev = NULL;
-        list_node->next = NULL;
-        list->head = list_node;
-        // pointer drawing breakpoint
-    } else if (index <= 0) { // covers case 2
-        list_node->prev = NULL;
-        list_node->next = list->head;
-        list->head->prev = list_node;
-        list->head = list_node;
-        // pointer drawing breakpoint
-    } else {
-        ref_at_index = dpl_get_reference_at_index(list, index);
-        assert(ref_at_index != NULL);
-        // pointer drawing breakpoint
-        if (index < dpl_size(list)) { // covers case 4
-            list_node->prev = ref_at_index->prev;
-            list_node->next = ref_at_index;
-            ref_at_index->prev->next = list_node;
-            ref_at_index->prev = list_node;
-            // pointer drawing breakpoint
-        } else { // covers case 3
-            assert(ref_at_index->next == NULL);
-            list_node->next = NULL;
-            list_node->prev = ref_at_index;
-            ref_at_index->next = list_node;
-            // pointer drawing breakpoint
-        }
+    return list_node;
+}
+
+/*
+ * Checks that 'reference' is a node of 'list', O(n): only used by the reference functions that promise this check
+ */
+static bool dpl_has_reference(dplist_t *list, dplist_node_t *reference) {
+    for (dplist_node_t *current = list->head; current != NULL; current = current->next) {
+        if (current == reference) return true;
     }
+    return false;
+}
+
+dplist_t *dpl_insert_at_index(dplist_t *list, void *element, int index, bool insert_copy) {
+    if (list == NULL) return NULL;
+    dplist_node_t *list_node = dpl_new_node(list, element, insert_copy);
+    // appending needs no walk, it links in after the tail
+    dpl_link_before(list, list_node, index < list->size ? dpl_get_reference_at_index(list, index) : NULL);
     return list;
 }
 
 dplist_t *dpl_remove_at_index(dplist_t *list, int index, bool free_element) {
     if (list == NULL) return NULL;
     if (list->head == NULL) return list;
-
-    dplist_node_t *current = dpl_get_reference_at_index(list, index);
-
-    if (index <= 0)
-    {
-        list->head = current->next;
-        if(current->next != NULL) (list->head)->prev = NULL;
-        if(free_element) list->element_free(&(current->element));
-        free(current);
-
-    } else if (index >= dpl_size(list)-1)
-    {
-        if(dpl_size(list)>1)(current->prev)->next = NULL;
-        else list->head = NULL;
-        if(free_element) list->element_free(&(current->element));
-        free(current);
-    } else
-    {
-        dplist_node_t *prev = current->prev;
-        dplist_node_t *next = current->next;
-        prev->next = next;
-        next->prev = prev;
-        free(current);
-    }
+    dpl_unlink(list, dpl_get_reference_at_index(list, index), free_element);
     return list;
 }
 
 int dpl_size(dplist_t *list) {
     if (list == NULL) return -1;
-
-    int count = 0;
-    dplist_node_t *current = (list->head);
-    while (current != NULL)
-    {
-        count++;
-        current = current->next;
-    }
-    return count;
+    return list->size;
 }
 
 void *dpl_get_element_at_index(dplist_t *list, int index) {
     if (list == NULL) return NULL;
-    if (list->head == NULL) return NULL;
-    if (index <= 0) return (list->head)->element;
-
-    int count = 0;
-    dplist_node_t *current = list->head;
-    while (current->next != NULL && count < index)
-    {
-        current = current->next;
-        count++;
-    }
-    return current->element;
+    dplist_node_t *reference = dpl_get_reference_at_index(list, index);
+    return reference == NULL ? NULL : reference->element;
 }
 
 int dpl_get_index_of_element(dplist_t *list, void *element) {
@@ -198,8 +181,13 @@ dplist_node_t *dpl_get_reference_at_index(dplist_t *list, int index) {
     dplist_node_t *dummy;
     DPLIST_ERR_HANDLER(list == NULL, DPLIST_INVALID_ERROR);
     if (list->head == NULL) return NULL;
-    for (dummy = list->head, count = 0; dummy->next != NULL; dummy = dummy->next, count++) {
-        if (count >= index) return dummy;
+    if (index <= 0) return list->head;
+    if (index >= list->size - 1) return list->tail;
+    // walk from the closest end
+    if (index < list->size / 2) {
+        for (dummy = list->head, count = 0; count < index; dummy = dummy->next, count++);
+    } else {
+        for (dummy = list->tail, count = list->size - 1; count > index; dummy = dummy->prev, count--);
     }
     return dummy;
 }
@@ -234,7 +222,84 @@ dplist_node_t *dpl_get_reference_of_element(dplist_t *list, void *element) {
 }
 
 void *dpl_get_element(dplist_t *list, void*element) {
-    int index = dpl_get_index_of_element(list, element);
-    if (index == -1) return NULL;
-    return dpl_get_element_at_index(list,index);
+    dplist_node_t *reference = dpl_get_reference_of_element(list, element);
+    if (reference == NULL) return NULL;
+    return reference->element;
+}
+
+dplist_node_t *dpl_get_first_reference(dplist_t *list) {
+    if (list == NULL) return NULL;
+    return list->head;
+}
+
+dplist_node_t *dpl_get_last_reference(dplist_t *list) {
+    if (list == NULL) return NULL;
+    return list->tail;
+}
+
+dplist_node_t *dpl_get_next_reference(dplist_t *list, dplist_node_t *reference) {
+    if (list == NULL || reference == NULL || !dpl_has_reference(list, reference)) return NULL;
+    return reference->next;
+}
+
+dplist_node_t *dpl_get_previous_reference(dplist_t *list, dplist_node_t *reference) {
+    if (list == NULL || reference == NULL || !dpl_has_reference(list, reference)) return NULL;
+    return reference->prev;
+}
+
+int dpl_get_index_of_reference(dplist_t *list, dplist_node_t *reference) {
+    if (list == NULL || reference == NULL) return -1;
+    int count = 0;
+    for (dplist_node_t *current = list->head; current != NULL; current = current->next, count++) {
+        if (current == reference) return count;
+    }
+    return -1;
+}
+
+dplist_t *dpl_insert_at_reference(dplist_t *list, void *element, dplist_node_t *reference, bool insert_copy) {
+    if (list == NULL || reference == NULL) return NULL;
+    if (!dpl_has_reference(list, reference)) return list;
+    dpl_link_before(list, dpl_new_node(list, element, insert_copy), reference);
+    return list;
+}
+
+dplist_t *dpl_insert_sorted(dplist_t *list, void *element, bool insert_copy) {
+    if (list == NULL) return NULL;
+    dplist_node_t *current = list->head;
+    while (current != NULL && list->element_compare(current->element, element) < 0) current = current->next;
+    dpl_link_before(list, dpl_new_node(list, element, insert_copy), current);
+    return list;
+}
+
+dplist_t *dpl_remove_at_reference(dplist_t *list, dplist_node_t *reference, bool free_element) {
+    if (list == NULL || reference == NULL) return NULL;
+    if (!dpl_has_reference(list, reference)) return list;
+    dpl_unlink(list, reference, free_element);
+    return list;
+}
+
+dplist_t *dpl_remove_element(dplist_t *list, void *element, bool free_element) {
+    if (list == NULL) return NULL;
+    dplist_node_t *reference = dpl_get_reference_of_element(list, element);
+    if (reference != NULL) dpl_unlink(list, reference, free_element);
+    return list;
+}
+
+void *dpl_iter_first(dplist_t *list, dplist_iter_t *iter) {
+    iter->list = list;
+    iter->current = list == NULL ? NULL : list->head;
+    iter->next = iter->current == NULL ? NULL : iter->current->next;
+    return iter->current == NULL ? NULL : iter->current->element;
+}
+
+void *dpl_iter_next(dplist_iter_t *iter) {
+    iter->current = iter->next;
+    iter->next = iter->current == NULL ? NULL : iter->current->next;
+    return iter->current == NULL ? NULL : iter->current->element;
+}
+
+void dpl_iter_remove(dplist_iter_t *iter, bool free_element) {
+    if (iter->current == NULL) return;
+    dpl_unlink(iter->list, iter->current, free_element);
+    iter->current = NULL;
 }
@@ -19,6 +19,15 @@ typedef struct dplist dplist_t;
 
 typedef struct dplist_node dplist_node_t;
 
+/**
+ * Cursor over a list, see dpl_iter_first(). Lives on the stack of the caller, the fields are private.
+ */
+typedef struct {
+    dplist_t *list;
+    dplist_node_t *current;
+    dplist_node_t *next;        /**< saved before the caller sees 'current', so it may be removed */
+} dplist_iter_t;
+
 /* General remark on error handling
  * All functions below will:
  * - use assert() to check if memory allocation was successfully.
@@ -45,7 +54,7 @@ dplist_t *dpl_create(
  */
 void dpl_free(dplist_t **list, bool free_element);
 
-/** Returns the number of elements in the list.
+/** Returns the number of elements in the list, in O(1).
  * - If 'list' is is NULL, -1 is returned.
  * \param list a pointer to the list
  * \return the size of the list
@@ -235,6 +244,35 @@ dplist_t *dpl_remove_element(dplist_t *list, void *element, bool free_element);
 
 // ---- you can add your extra operators here ----//
 
+/** Returns the element of the first list node in the list containing 'element' (see dpl_get_reference_of_element()).
+ * \param list a pointer to the list
+ * \param element a pointer to an element to compare with
+ * \return the element in the list or NULL
+ */
 void *dpl_get_element(dplist_t *list, void*element);
 
+/** Starts iterating over the list, every step and removing the current element are O(1):
+ *      for (elem = dpl_iter_first(list, &iter); elem != NULL; elem = dpl_iter_next(&iter))
+ * - The iteration stops at the first NULL element, so lists that store NULL elements can't be iterated this way.
+ * - The list must not be changed during the iteration, other than by dpl_iter_remove().
+ * - If 'list' is NULL or empty, NULL is returned.
+ * \param list a pointer to the list
+ * \param iter the cursor to initialize
+ * \return the first element or NULL
+ */
+void *dpl_iter_first(dplist_t *list, dplist_iter_t *iter);
+
+/** Moves the cursor to the next list node.
+ * \param iter the cursor
+ * \return the next element, or NULL at the end of the list
+ */
+void *dpl_iter_next(dplist_iter_t *iter);
+
+/** Removes the list node at the cursor, the next dpl_iter_next() continues with the list node after it.
+ * - If the cursor is at the end of the list or its list node was removed already, nothing is done.
+ * \param iter the cursor
+ * \param free_element if true call element_free() on the element of the list node to remove
+ */
+void dpl_iter_remove(dplist_iter_t *iter, bool free_element);
+
 #endif  // _DPLIST_H_
@@ -6,11 +6,13 @@
 
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <errno.h>
+#include <fcntl.h>
 
 #include "tcpsock.h"
 
@@ -56,6 +58,9 @@ struct tcpsock {
     int sd;             /**< socket descriptor */
     char *ip_addr;      /**< socket IP address */
     int port;           /**< socket port number */
+    char *rx_buf;       /**< receive buffer of TCP_RX_BUFFER_SIZE bytes, NULL until the first tcp_fill() */
+    int rx_start;       /**< first buffered byte */
+    int rx_end;         /**< end of the buffered bytes */
 };
 
 static tcpsock_t *tcp_sock_create();
@@ -134,6 +139,7 @@ int tcp_close(tcpsock_t **socket) {
         {
             free((*socket)->ip_addr);
         }
+        free((*socket)->rx_buf);
         if ((*socket)->sd >= 0) {
             // maybe a connection is still open?
             result = shutdown((*socket)->sd, SHUT_RDWR);
@@ -150,6 +156,7 @@ int tcp_close(tcpsock_t **socket) {
     (*socket)->port = -1;
     (*socket)->sd = -1;
     (*socket)->ip_addr = NULL;
+    (*socket)->rx_buf = NULL;
     free(*socket);
     *socket = NULL;
     return TCP_NO_ERROR;
@@ -208,6 +215,13 @@ int tcp_receive(tcpsock_t *socket, void *buffer, int *buf_size) {
         *buf_size = 0;
         return TCP_NO_ERROR;
     }
+    if (socket->rx_end > socket->rx_start) // buffered by tcp_fill(), no need to receive
+    {
+        if (*buf_size > socket->rx_end - socket->rx_start) *buf_size = socket->rx_end - socket->rx_start;
+        memcpy(buffer, socket->rx_buf + socket->rx_start, *buf_size);
+        socket->rx_start += *buf_size;
+        return TCP_NO_ERROR;
+    }
     *buf_size = recv(socket->sd, buffer, *buf_size, 0);
     TCP_DEBUG_PRINTF(*buf_size == 0, "Recv() : no connection to peer\n");
     TCP_ERR_HANDLER(*buf_size == 0, return TCP_CONNECTION_CLOSED);
@@ -218,6 +232,116 @@ int tcp_receive(tcpsock_t *socket, void *buffer, int *buf_size) {
     return TCP_NO_ERROR;
 }
 
+int tcp_fill(tcpsock_t *socket, int *buf_size) {
+    TCP_ERR_HANDLER(socket == NULL, return TCP_SOCKET_ERROR);
+    TCP_ERR_HANDLER(socket->cookie != MAGIC_COOKIE, return TCP_SOCKET_ERROR);
+    *buf_size = 0;
+    if (socket->rx_buf == NULL) {
+        socket->rx_buf = (char *) malloc(TCP_RX_BUFFER_SIZE);
+        TCP_ERR_HANDLER(socket->rx_buf == NULL, return TCP_MEMORY_ERROR);
+    }
+    // move the leftover (usually a partial record) to the front, so the free space is in one piece
+    if (socket->rx_start > 0) {
+        memmove(socket->rx_buf, socket->rx_buf + socket->rx_start, socket->rx_end - socket->rx_start);
+        socket->rx_end -= socket->rx_start;
+        socket->rx_start = 0;
+    }
+    if (socket->rx_end == TCP_RX_BUFFER_SIZE) return TCP_NO_ERROR;
+    int result;
+    do {
+        result = recv(socket->sd, socket->rx_buf + socket->rx_end, TCP_RX_BUFFER_SIZE - socket->rx_end, 0);
+    } while ((result < 0) && (errno == EINTR));
+    TCP_DEBUG_PRINTF(result == 0, "Recv() : no connection to peer\n");
+    TCP_ERR_HANDLER(result == 0, return TCP_CONNECTION_CLOSED);
+    TCP_ERR_HANDLER((result < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK)), return TCP_WOULD_BLOCK);
+    TCP_DEBUG_PRINTF((result < 0) && (errno == ENOTCONN), "Recv() : no connection to peer\n");
+    TCP_ERR_HANDLER((result < 0) && (errno == ENOTCONN), return TCP_CONNECTION_CLOSED);
+    TCP_DEBUG_PRINTF(result < 0, "Recv() failed with errno = %d [%s]", errno, strerror(errno));
+    TCP_ERR_HANDLER(result < 0, return TCP_SOCKOP_ERROR);
+    socket->rx_end += result;
+    *buf_size = result;
+    return TCP_NO_ERROR;
+}
+
+int tcp_peek(tcpsock_t *socket, void **buffer, int *buf_size) {
+    TCP_ERR_HANDLER(socket == NULL, return TCP_SOCKET_ERROR);
+    TCP_ERR_HANDLER(socket->cookie != MAGIC_COOKIE, return TCP_SOCKET_ERROR);
+    if (buffer != NULL) *buffer = socket->rx_buf + socket->rx_start;
+    *buf_size = socket->rx_end - socket->rx_start;
+    return TCP_NO_ERROR;
+}
+
+int tcp_receive_exact(tcpsock_t *socket, void *buffer, int buf_size) {
+    int result, received;
+    TCP_ERR_HANDLER(socket == NULL, return TCP_SOCKET_ERROR);
+    TCP_ERR_HANDLER(socket->cookie != MAGIC_COOKIE, return TCP_SOCKET_ERROR);
+    TCP_ERR_HANDLER(buf_size > TCP_RX_BUFFER_SIZE, return TCP_MEMORY_ERROR);
+    if (buf_size <= 0) return TCP_NO_ERROR;
+    while (socket->rx_end - socket->rx_start < buf_size) {
+        result = tcp_fill(socket, &received);
+        if (result != TCP_NO_ERROR) return result;
+    }
+    memcpy(buffer, socket->rx_buf + socket->rx_start, buf_size);
+    socket->rx_start += buf_size;
+    if (socket->rx_start == socket->rx_end) socket->rx_start = socket->rx_end = 0;
+    return TCP_NO_ERROR;
+}
+
+/*
+ * setsockopt() of one int option, with the error handling of the tcp_set_... functions
+ */
+static int tcp_set_option(tcpsock_t *socket, int level, int option, int value) {
+    int result;
+    TCP_ERR_HANDLER(socket == NULL, return TCP_SOCKET_ERROR);
+    TCP_ERR_HANDLER(socket->cookie != MAGIC_COOKIE, return TCP_SOCKET_ERROR);
+    result = setsockopt(socket->sd, level, option, &value, sizeof(value));
+    TCP_DEBUG_PRINTF(result == -1, "Setsockopt() failed with errno = %d [%s]", errno, strerror(errno));
+    TCP_ERR_HANDLER(result != 0, return TCP_SOCKOP_ERROR);
+    return TCP_NO_ERROR;
+}
+
+int tcp_set_nonblocking(tcpsock_t *socket, int enable) {
+    int flags;
+    TCP_ERR_HANDLER(socket == NULL, return TCP_SOCKET_ERROR);
+    TCP_ERR_HANDLER(socket->cookie != MAGIC_COOKIE, return TCP_SOCKET_ERROR);
+    flags = fcntl(socket->sd, F_GETFL);
+    TCP_DEBUG_PRINTF(flags == -1, "Fcntl() failed with errno = %d [%s]", errno, strerror(errno));
+    TCP_ERR_HANDLER(flags == -1, return TCP_SOCKOP_ERROR);
+    flags = enable ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK);
+    TCP_ERR_HANDLER(fcntl(socket->sd, F_SETFL, flags) == -1, return TCP_SOCKOP_ERROR);
+    return TCP_NO_ERROR;
+}
+
+int tcp_set_nodelay(tcpsock_t *socket, int enable) {
+    return tcp_set_option(socket, IPPROTO_TCP, TCP_NODELAY, enable != 0);
+}
+
+int tcp_set_rcvbuf(tcpsock_t *socket, int bytes) {
+    return tcp_set_option(socket, SOL_SOCKET, SO_RCVBUF, bytes);
+}
+
+int tcp_set_sndbuf(tcpsock_t *socket, int bytes) {
+    return tcp_set_option(socket, SOL_SOCKET, SO_SNDBUF, bytes);
+}
+
+int tcp_set_keepalive(tcpsock_t *socket, int idle, int interval, int count) {
+    int result = tcp_set_option(socket, SOL_SOCKET, SO_KEEPALIVE, idle > 0);
+    if ((result != TCP_NO_ERROR) || (idle <= 0)) return result;
+    result = tcp_set_option(socket, IPPROTO_TCP, TCP_KEEPIDLE, idle);
+    if (result == TCP_NO_ERROR) result = tcp_set_option(socket, IPPROTO_TCP, TCP_KEEPINTVL, interval);
+    if (result == TCP_NO_ERROR) result = tcp_set_option(socket, IPPROTO_TCP, TCP_KEEPCNT, count);
+    return result;
+}
+
+int tcp_set_busy_poll(tcpsock_t *socket, int usec) {
+#ifdef SO_BUSY_POLL
+    return tcp_set_option(socket, SOL_SOCKET, SO_BUSY_POLL, usec);
+#else
+    TCP_ERR_HANDLER(socket == NULL, return TCP_SOCKET_ERROR);
+    return TCP_SOCKOP_ERROR;
+#endif
+}
+
 int tcp_get_ip_addr(tcpsock_t *socket, char **ip_addr) {
     TCP_ERR_HANDLER(socket == NULL, return TCP_SOCKET_ERROR);
     TCP_ERR_HANDLER(socket->cookie != MAGIC_COOKIE, return TCP_SOCKET_ERROR);
@@ -247,6 +371,9 @@ static tcpsock_t *tcp_sock_create() {
         s->port = -1;
         s->ip_addr = NULL;
         s->sd = -1;
+        s->rx_buf = NULL;
+        s->rx_start = 0;
+        s->rx_end = 0;
     }
     return s;
 }
@@ -14,9 +14,17 @@
 #define    TCP_SOCKOP_ERROR         3   // socket operator (socket, listen, bind, accept,...) error
 #define    TCP_CONNECTION_CLOSED    4   // send/receive indicate connection is closed
 #define    TCP_MEMORY_ERROR         5   // mem alloc error
+#define    TCP_WOULD_BLOCK          6   // a non-blocking socket has no data (yet)
 
 #define MAX_PENDING 10
 
+/*
+ * Size of the receive buffer of a socket, see tcp_fill(). It's allocated by the first tcp_fill() or tcp_receive_exact().
+ */
+#ifndef TCP_RX_BUFFER_SIZE
+#define TCP_RX_BUFFER_SIZE 4096
+#endif
+
 typedef struct tcpsock tcpsock_t;
 
 /**
@@ -87,6 +95,7 @@ int tcp_send(tcpsock_t *socket, void *buffer, int *buf_size);
 /**
  * Initiates a receive command on the socket 'socket' and tries to receive the total '*buf_size' bytes of data in 'buffer' (recall that the function might block for a while)
  * The function sets '*buf_size' to the number of bytes that were really received, which might be less than the inital '*buf_size'
+ * Bytes already in the receive buffer of 'socket' (see tcp_fill()) are returned first, without a receive command
  * If a socket error happens while receiving data or the connection is closed, TCP_SOCKOP_ERROR or TCP_CONNECTION_CLOSED is returned, respectively
  * If 'socket' is NULL or not yet bound, TCP_SOCKET_ERROR is returned
  * \param socket the socket where the data needs to be received from
@@ -96,6 +105,112 @@ int tcp_send(tcpsock_t *socket, void *buffer, int *buf_size);
  */
 int tcp_receive(tcpsock_t *socket, void *buffer, int *buf_size);
 
+/**
+ * Initiates one receive command on the socket 'socket' that appends whatever is available (at most the free space) to the receive buffer of 'socket'
+ * The buffered bytes are taken out with tcp_peek(), tcp_receive_exact() or tcp_receive(), without any further receive command
+ * The function sets '*buf_size' to the number of bytes that were received, 0 if the buffer is full
+ * If a non-blocking socket has nothing to receive, TCP_WOULD_BLOCK is returned
+ * If a socket error happens while receiving data or the connection is closed, TCP_SOCKOP_ERROR or TCP_CONNECTION_CLOSED is returned, respectively
+ * If memory allocation for the buffer fails, TCP_MEMORY_ERROR is returned
+ * If 'socket' is NULL or not yet bound, TCP_SOCKET_ERROR is returned
+ * \param socket the socket where the data needs to be received from
+ * \param buf_size a pointer to an int that will hold the number of bytes received
+ * \return TCP_NO_ERROR if no error occurs during execution
+ */
+int tcp_fill(tcpsock_t *socket, int *buf_size);
+
+/**
+ * Set '*buffer' to the bytes in the receive buffer of 'socket' and '*buf_size' to their number, nothing is received or taken out of the buffer
+ * No memory allocation is done (pointer reference assignment!), the bytes stay valid until the next receive or close on 'socket'
+ * If 'socket' is NULL or not yet bound, TCP_SOCKET_ERROR is returned
+ * \param socket the socket to look at
+ * \param buffer a pointer to a void* that will point to the buffered bytes, may be NULL if only the number is needed
+ * \param buf_size a pointer to an int that will hold the number of buffered bytes
+ * \return TCP_NO_ERROR if no error occurs during execution
+ */
+int tcp_peek(tcpsock_t *socket, void **buffer, int *buf_size);
+
+/**
+ * Takes exactly 'buf_size' bytes out of the receive buffer of 'socket' and copies them to 'buffer'
+ * Receive commands are only initiated for the bytes that aren't buffered yet (recall that the function might block for a while on a blocking socket)
+ * If a non-blocking socket runs out of data first, TCP_WOULD_BLOCK is returned: the bytes that did arrive stay in the buffer for the next call
+ * If a socket error happens while receiving data or the connection is closed first, TCP_SOCKOP_ERROR or TCP_CONNECTION_CLOSED is returned, respectively
+ * If memory allocation for the buffer fails or 'buf_size' is bigger than TCP_RX_BUFFER_SIZE, TCP_MEMORY_ERROR is returned
+ * If 'socket' is NULL or not yet bound, TCP_SOCKET_ERROR is returned
+ * \param socket the socket where the data needs to be received from
+ * \param buffer a pointer to the buffer that can store 'buf_size' bytes
+ * \param buf_size the amount of bytes to take, at most TCP_RX_BUFFER_SIZE
+ * \return TCP_NO_ERROR if no error occurs during execution
+ */
+int tcp_receive_exact(tcpsock_t *socket, void *buffer, int buf_size);
+
+/**
+ * Puts 'socket' in non-blocking mode (if 'enable' is non-zero) or back in blocking mode
+ * On a non-blocking socket tcp_fill() and tcp_receive_exact() return TCP_WOULD_BLOCK instead of waiting for data
+ * If 'socket' is NULL or not yet bound, TCP_SOCKET_ERROR is returned
+ * If the socket operation fails, TCP_SOCKOP_ERROR is returned
+ * \param socket the socket to change
+ * \param enable non-zero for non-blocking mode
+ * \return TCP_NO_ERROR if no error occurs during execution
+ */
+int tcp_set_nonblocking(tcpsock_t *socket, int enable);
+
+/**
+ * Turns Nagle's algorithm off (if 'enable' is non-zero) or on (TCP_NODELAY), small sends then leave immediately
+ * If 'socket' is NULL or not yet bound, TCP_SOCKET_ERROR is returned
+ * If the socket operation fails, TCP_SOCKOP_ERROR is returned
+ * \param socket the socket to change
+ * \param enable non-zero to send without delay
+ * \return TCP_NO_ERROR if no error occurs during execution
+ */
+int tcp_set_nodelay(tcpsock_t *socket, int enable);
+
+/**
+ * Sets the size of the kernel receive buffer of 'socket' (SO_RCVBUF), the kernel doubles it for its bookkeeping
+ * and no longer tunes it automatically
+ * If 'socket' is NULL or not yet bound, TCP_SOCKET_ERROR is returned
+ * If the socket operation fails, TCP_SOCKOP_ERROR is returned
+ * \param socket the socket to change
+ * \param bytes the requested size, capped by net.core.rmem_max
+ * \return TCP_NO_ERROR if no error occurs during execution
+ */
+int tcp_set_rcvbuf(tcpsock_t *socket, int bytes);
+
+/**
+ * Sets the size of the kernel send buffer of 'socket' (SO_SNDBUF), see tcp_set_rcvbuf()
+ * If 'socket' is NULL or not yet bound, TCP_SOCKET_ERROR is returned
+ * If the socket operation fails, TCP_SOCKOP_ERROR is returned
+ * \param socket the socket to change
+ * \param bytes the requested size, capped by net.core.wmem_max
+ * \return TCP_NO_ERROR if no error occurs during execution
+ */
+int tcp_set_sndbuf(tcpsock_t *socket, int bytes);
+
+/**
+ * Turns TCP keepalive on: after 'idle' s without traffic a probe is sent every 'interval' s, and the connection is
+ * reset after 'count' unanswered probes (so a dead peer is noticed after idle + interval * count s)
+ * With 'idle' 0 keepalive is turned off and 'interval' and 'count' are ignored
+ * If 'socket' is NULL or not yet bound, TCP_SOCKET_ERROR is returned
+ * If a socket operation fails, TCP_SOCKOP_ERROR is returned
+ * \param socket the socket to change
+ * \param idle seconds of silence before the first probe, 0 to turn keepalive off
+ * \param interval seconds between probes
+ * \param count probes before the connection is reset
+ * \return TCP_NO_ERROR if no error occurs during execution
+ */
+int tcp_set_keepalive(tcpsock_t *socket, int idle, int interval, int count);
+
+/**
+ * Lets a blocking receive on 'socket' busy poll the device queue for up to 'usec' us before it sleeps (SO_BUSY_POLL)
+ * Raising it above net.core.busy_read needs CAP_NET_ADMIN
+ * If 'socket' is NULL or not yet bound, TCP_SOCKET_ERROR is returned
+ * If the socket operation fails or the system has no busy polling, TCP_SOCKOP_ERROR is returned
+ * \param socket the socket to change
+ * \param usec the busy poll time, 0 to turn it off
+ * \return TCP_NO_ERROR if no error occurs during execution
+ */
+int tcp_set_busy_poll(tcpsock_t *socket, int usec);
+
 /**
  * Set '*ip_addr' to the IP address of 'socket' (could be NULL if the IP address is not set)
  * No memory allocation is done (pointer reference assignment!), hence, no free must be called to avoid a memory leak
@@ -0,0 +1,485 @@
+/**
+ * \author Koen Eelen
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <sys/stat.h>
+#include <inttypes.h>
+#include "logger.h"
+
+#if LOG_RING_SIZE & (LOG_RING_SIZE - 1)
+#error LOG_RING_SIZE must be a power of 2
+#endif
+
+/**
+ * A record of the ring, 'seq' tells producers and the writer whose turn it is (bounded MPMC queue of D. Vyukov):
+ * seq == position: free for the producer that claims 'position'
+ * seq == position + 1: filled, ready for the writer
+ */
+typedef struct {
+    atomic_size_t seq;
+    log_event_t event;
+} log_record_t;
+
+/**
+ * Text of the events, in the order of log_event_type_t. The arguments of 'format' are the ones listed in logger.h.
+ */
+static const struct {
+    const char *name;
+    const char *format;
+} event_types[LOG_EVENT_COUNT] = {
+    [LOG_SENSOR_OPENED] = {"opened", "A sensor node with id:%d has opened a new connection."},
+    [LOG_SENSOR_CLOSED] = {"closed", "A sensor node with id:%d has closed the connection."},
+    [LOG_SENSOR_INVALID] = {"invalid", "Received sensor data with invalid sensor node ID:%d"},
+    [LOG_THRESHOLDS_RELOADED] = {"reload", "Temperature thresholds reloaded."},
+    [LOG_TOO_COLD] = {"cold", "The sensor node with id:%d reports it’s too cold (running avg %f)"},
+    [LOG_TOO_HOT] = {"hot", "The sensor node with id:%d reports it’s too hot (running avg %f)"},
+    [LOG_STILL_TOO_COLD] = {"still-cold", "The sensor node with id:%d still reports it’s too cold (running avg %f)"},
+    [LOG_STILL_TOO_HOT] = {"still-hot", "The sensor node with id:%d still reports it’s too hot (running avg %f)"},
+    [LOG_BACK_TO_NORMAL] = {"normal", "The sensor node with id:%d reports the temperature is back to normal (running avg %f)"},
+    [LOG_ANOMALY] = {"anomaly", "The sensor node with id:%d reports an anomaly: %s (%g at %" PRId64 ")"},
+    [LOG_DB_UNAVAILABLE] = {"db-unavailable", "Unable to connect to SQL server."},
+    [LOG_DB_TABLE_CREATED] = {"db-table", "New table " TO_STRING(TABLE_NAME) " created."},
+    [LOG_DB_CONNECTED] = {"db-connected", "Connection to SQL server established."},
+    [LOG_DB_LOST] = {"db-lost", "Connection to SQL server lost, spooling to " TO_STRING(DB_SPOOL_FILE) "."},
+    [LOG_DB_RECONNECTING] = {"db-reconnect", "Reconnecting to SQL server."},
+    [LOG_DB_REPLAYED] = {"db-replayed", "Replayed %" PRIu32 " rows from " TO_STRING(DB_SPOOL_FILE) "."},
+    [LOG_TSDB_OPENED] = {"tsdb-opened", "Time-series store " TO_STRING(TSDB_DIR) " opened."},
+    [LOG_STORE_FAILED] = {"store-failed", "Failed to store %" PRIu32 " rows."},
+    [LOG_DROPPED] = {"dropped", "%" PRIu32 " log messages dropped"},
+    [LOG_DB_QUARANTINED] = {"db-quarantined", "Batch of %" PRIu32 " rows rejected, moved to " TO_STRING(DB_QUARANTINE_FILE) "."},
+    [LOG_DB_CORRUPT] = {"db-corrupt", "Database " TO_STRING(DB_NAME) " is corrupt, moved to " TO_STRING(DB_NAME) ".corrupt."},
+};
+
+static log_record_t ring[LOG_RING_SIZE];
+static atomic_size_t enqueue_pos;
+static size_t dequeue_pos;          /**< only used by the writer thread */
+static atomic_ulong drops;
+static atomic_int running;
+static atomic_int stop;
+static atomic_bool writer_sleeping;  /**< set while the writer waits on 'wakeup', only then producers post it */
+static sem_t wakeup;
+static pthread_t writer_thread;
+
+/*
+ * The log file and the output buffer, only used by the writer thread once it's started
+ */
+static char log_path[256];
+static int log_fd = -1;
+static off_t log_size;
+static time_t log_started;          /**< timestamp of the first event in the log file, for LOG_ROTATE_SECONDS */
+static uint64_t sequence;
+static bool log_dirty;              /**< written but not synced yet */
+static char out_buffer[LOG_BUFFER_SIZE];
+static size_t out_length;
+
+static void *logger_writer(void *arg);
+static int open_log();
+static int read_log_event(const char *path, bool last, log_event_t *event);
+static double elapsed_ms(struct timespec *since);
+
+int logger_init(const char *path)
+{
+    if (strlen(path) >= sizeof(log_path)) return 1;
+    strcpy(log_path, path);
+    sequence = 0;
+    out_length = 0;
+    log_dirty = false;
+    if (open_log() != 0) return 1;
+
+    //continue the sequence numbers of the previous run, its last event can be in the newest rotated file
+    log_event_t last;
+    char rotated[sizeof(log_path) + 16];
+    snprintf(rotated, sizeof(rotated), "%s.1", log_path);
+    if (read_log_event(log_path, true, &last) == 0 || read_log_event(rotated, true, &last) == 0) sequence = last.seq + 1;
+    for (size_t i = 0; i < LOG_RING_SIZE; i++) atomic_init(&ring[i].seq, i);
+    atomic_init(&enqueue_pos, 0);
+    dequeue_pos = 0;
+    atomic_init(&drops, 0);
+    atomic_init(&stop, false);
+    atomic_init(&writer_sleeping, false);
+    sem_init(&wakeup, 0, 0);
+    pthread_create(&writer_thread, NULL, logger_writer, NULL);
+    atomic_store(&running, true);
+    return 0;
+}
+
+/*
+ * Claims the next free record of the ring, NULL (and a drop is counted) if the ring is full
+ * The caller fills out the event and hands it to the writer with publish_record()
+ */
+static log_record_t *claim_record(size_t *position)
+{
+    if (!atomic_load_explicit(&running, memory_order_acquire)) return NULL;
+    size_t pos = atomic_load_explicit(&enqueue_pos, memory_order_relaxed);
+    while (true)
+    {
+        log_record_t *record = &ring[pos & (LOG_RING_SIZE - 1)];
+        size_t seq = atomic_load_explicit(&record->seq, memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+        if (diff == 0)
+        {
+            if (atomic_compare_exchange_weak_explicit(&enqueue_pos, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed))
+            {
+                *position = pos;
+                return record;
+            }
+        } else if (diff < 0)
+        {
+            //the writer hasn't freed this record yet: the ring is full
+            atomic_fetch_add_explicit(&drops, 1, memory_order_relaxed);
+            return NULL;
+        } else
+        {
+            pos = atomic_load_explicit(&enqueue_pos, memory_order_relaxed);
+        }
+    }
+}
+
+/*
+ * Hands the record to the writer, the semaphore is only posted when the writer is waiting for one, and then by one
+ * producer only: a busy writer picks the record up without a system call
+ */
+static void publish_record(log_record_t *record, size_t position)
+{
+    atomic_store_explicit(&record->seq, position + 1, memory_order_release);
+    //pairs with the fence in logger_writer(): either the writer sees the record or this sees the writer sleeping
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&writer_sleeping, memory_order_relaxed) &&
+        atomic_exchange_explicit(&writer_sleeping, false, memory_order_relaxed)) sem_post(&wakeup);
+}
+
+void logger_event(log_event_type_t type, sensor_id_t sensor_id, uint32_t count, double value)
+{
+    size_t position;
+    log_record_t *record = claim_record(&position);
+    if (record == NULL) return;
+    record->event.ts = time(NULL);
+    record->event.type = type;
+    record->event.sensor_id = sensor_id;
+    record->event.count = count;
+    record->event.value = value;
+    record->event.data_ts = 0;
+    record->event.detail[0] = '\0';
+    publish_record(record, position);
+}
+
+void logger_anomaly(sensor_id_t sensor_id, const char *detector, double detail, sensor_ts_t ts)
+{
+    size_t position;
+    log_record_t *record = claim_record(&position);
+    if (record == NULL) return;
+    record->event.ts = time(NULL);
+    record->event.type = LOG_ANOMALY;
+    record->event.sensor_id = sensor_id;
+    record->event.count = 0;
+    record->event.value = detail;
+    record->event.data_ts = ts;
+    strncpy(record->event.detail, detector, sizeof(record->event.detail) - 1);
+    record->event.detail[sizeof(record->event.detail) - 1] = '\0';
+    publish_record(record, position);
+}
+
+unsigned long logger_get_drops()
+{
+    return atomic_load(&drops);
+}
+
+/*
+ * The writer only stops once it has caught up with every record claimed before 'running' was cleared, an event that
+ * is logged while logger_free() runs may still be dropped
+ */
+void logger_free()
+{
+    if (!atomic_load(&running)) return;
+    atomic_store(&running, false);
+    atomic_store(&stop, true);
+    sem_post(&wakeup);
+    pthread_join(writer_thread, NULL);
+    sem_destroy(&wakeup);
+    if (log_fd >= 0) close(log_fd);
+    log_fd = -1;
+}
+
+/*
+ * Shifts the rotated files up by one (LOG_FILE.1 to LOG_FILE.2, ...) and moves the log file to LOG_FILE.1,
+ * the oldest file beyond LOG_KEEP is overwritten
+ */
+static void rotate_files()
+{
+    char from[sizeof(log_path) + 16];
+    char to[sizeof(log_path) + 16];
+    if (LOG_KEEP <= 0)
+    {
+        unlink(log_path);
+        return;
+    }
+    for (int i = LOG_KEEP - 1; i > 0; i--)
+    {
+        snprintf(from, sizeof(from), "%s.%d", log_path, i);
+        snprintf(to, sizeof(to), "%s.%d", log_path, i + 1);
+        rename(from, to);
+    }
+    snprintf(to, sizeof(to), "%s.1", log_path);
+    rename(log_path, to);
+}
+
+/*
+ * Reads the first or the last event of a log file
+ * \return 0 if the event was read, 1 if the file has no events and -1 if it's missing or not a log file of this version
+ */
+static int read_log_event(const char *path, bool last, log_event_t *event)
+{
+    log_file_header_t expected = {LOG_MAGIC, LOG_VERSION, sizeof(log_event_t)};
+    log_file_header_t header;
+    struct stat st;
+    int result = -1;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return -1;
+    if (fstat(fd, &st) == 0 && st.st_size >= sizeof(header) && (st.st_size - sizeof(header)) % sizeof(log_event_t) == 0 &&
+        pread(fd, &header, sizeof(header), 0) == sizeof(header) && memcmp(&header, &expected, sizeof(header)) == 0)
+    {
+        if (st.st_size == sizeof(header))
+        {
+            result = 1;
+        } else
+        {
+            off_t offset = last ? st.st_size - sizeof(log_event_t) : sizeof(header);
+            if (pread(fd, event, sizeof(log_event_t), offset) == sizeof(log_event_t)) result = 0;
+        }
+    }
+    close(fd);
+    return result;
+}
+
+/*
+ * Opens the log file for appending and writes the header if it's new, a file of another version is rotated away first
+ */
+static int open_log()
+{
+    log_file_header_t header = {LOG_MAGIC, LOG_VERSION, sizeof(log_event_t)};
+    log_event_t event;
+    struct stat st;
+
+    log_fd = open(log_path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (log_fd < 0) return 1;
+    if (fstat(log_fd, &st) != 0) goto error;
+    log_size = st.st_size;
+    log_started = time(NULL);
+    if (log_size > 0)
+    {
+        int state = read_log_event(log_path, false, &event);
+        if (state == 0) log_started = event.ts;
+        if (state >= 0) return 0;
+        close(log_fd);
+        rotate_files();
+        log_fd = open(log_path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+        if (log_fd < 0) return 1;
+        log_size = 0;
+    }
+    if (write(log_fd, &header, sizeof(header)) != sizeof(header)) goto error;
+    log_size = sizeof(header);
+    return 0;
+
+error:
+    close(log_fd);
+    log_fd = -1;
+    return 1;
+}
+
+static void sync_log()
+{
+    if (log_dirty && log_fd >= 0) fdatasync(log_fd);
+    log_dirty = false;
+}
+
+/*
+ * Writes the output buffer to the log file and rotates it if it's full or old enough
+ * If the file can't be (re)opened, the buffered events are counted as dropped
+ */
+static void flush_buffer()
+{
+    if (log_fd < 0 && open_log() != 0)
+    {
+        atomic_fetch_add(&drops, out_length / sizeof(log_event_t));
+        out_length = 0;
+        return;
+    }
+    size_t written = 0;
+    while (written < out_length)
+    {
+        ssize_t result = write(log_fd, out_buffer + written, out_length - written);
+        if (result < 0)
+        {
+            if (errno == EINTR) continue;
+            break;
+        }
+        written += result;
+    }
+    log_size += written;
+    out_length = 0;
+    log_dirty = true;
+    if (LOG_FSYNC == LOG_FSYNC_BATCH) sync_log();
+
+    if ((LOG_ROTATE_SIZE > 0 && log_size >= LOG_ROTATE_SIZE) ||
+        (LOG_ROTATE_SECONDS > 0 && time(NULL) - log_started >= LOG_ROTATE_SECONDS))
+    {
+        if (LOG_FSYNC != LOG_FSYNC_NONE) sync_log();
+        close(log_fd);
+        rotate_files();
+        log_dirty = false;
+        open_log();
+    }
+}
+
+/*
+ * Copies an event into the output buffer, 'buffered_since' is set when it's the first one
+ */
+static void buffer_event(const log_event_t *event, struct timespec *buffered_since)
+{
+    if (out_length + sizeof(log_event_t) > LOG_BUFFER_SIZE) flush_buffer();
+    if (out_length == 0) clock_gettime(CLOCK_MONOTONIC, buffered_since);
+    memcpy(out_buffer + out_length, event, sizeof(log_event_t));
+    out_length += sizeof(log_event_t);
+}
+
+static void *logger_writer(void *arg)
+{
+    unsigned long reported_drops = 0;
+    log_event_t drop_event;
+    struct timespec buffered_since;
+    struct timespec last_sync;
+
+    memset(&drop_event, 0, sizeof(drop_event));
+    drop_event.type = LOG_DROPPED;
+    clock_gettime(CLOCK_MONOTONIC, &last_sync);
+    while (true)
+    {
+        //the records are copied out, so they go back to the producers right away
+        int records = 0;
+        while (true)
+        {
+            log_record_t *record = &ring[dequeue_pos & (LOG_RING_SIZE - 1)];
+            if (atomic_load_explicit(&record->seq, memory_order_acquire) != dequeue_pos + 1) break;
+            record->event.seq = sequence++;
+            buffer_event(&record->event, &buffered_since);
+            atomic_store_explicit(&record->seq, dequeue_pos + LOG_RING_SIZE, memory_order_release);
+            dequeue_pos++;
+            records++;
+        }
+        unsigned long dropped = atomic_load_explicit(&drops, memory_order_relaxed);
+        if (dropped != reported_drops)
+        {
+            drop_event.seq = sequence++;
+            drop_event.ts = time(NULL);
+            drop_event.count = dropped - reported_drops;
+            buffer_event(&drop_event, &buffered_since);
+            reported_drops = dropped;
+        }
+
+        bool stopping = atomic_load(&stop);
+        if (out_length > 0 && (stopping || elapsed_ms(&buffered_since) >= LOG_FLUSH_MS)) flush_buffer();
+        if (LOG_FSYNC == LOG_FSYNC_INTERVAL && log_dirty && elapsed_ms(&last_sync) >= LOG_FSYNC_MS)
+        {
+            sync_log();
+            clock_gettime(CLOCK_MONOTONIC, &last_sync);
+        }
+
+        if (records == 0)
+        {
+            if (stopping)
+            {
+                //a claimed record that isn't published yet would be lost
+                if (dequeue_pos == atomic_load(&enqueue_pos)) break;
+                sched_yield();
+                continue;
+            }
+            atomic_store_explicit(&writer_sleeping, true, memory_order_relaxed);
+            atomic_thread_fence(memory_order_seq_cst);
+            log_record_t *next = &ring[dequeue_pos & (LOG_RING_SIZE - 1)];
+            if (atomic_load_explicit(&next->seq, memory_order_acquire) == dequeue_pos + 1 || atomic_load(&stop))
+            {
+                atomic_store_explicit(&writer_sleeping, false, memory_order_relaxed);
+                continue;
+            }
+            struct timespec until;
+            clock_gettime(CLOCK_REALTIME, &until);
+            until.tv_nsec += (LOG_FLUSH_MS % 1000) * 1000000L;
+            until.tv_sec += LOG_FLUSH_MS / 1000 + until.tv_nsec / 1000000000L;
+            until.tv_nsec %= 1000000000L;
+            sem_timedwait(&wakeup, &until);
+            //a producer may have posted after a timeout, one pass over the ring covers whatever it published
+            atomic_store_explicit(&writer_sleeping, false, memory_order_relaxed);
+            while (sem_trywait(&wakeup) == 0);
+        }
+    }
+    if (out_length > 0) flush_buffer();
+    if (LOG_FSYNC != LOG_FSYNC_NONE) sync_log();
+    return NULL;
+}
+
+static double elapsed_ms(struct timespec *since)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - since->tv_sec) * 1e3 + (now.tv_nsec - since->tv_nsec) / 1e6;
+}
+
+const char *logger_event_name(int type)
+{
+    if (type < 0 || type >= LOG_EVENT_COUNT) return NULL;
+    return event_types[type].name;
+}
+
+int logger_format_event(const log_event_t *event, char *buf, size_t size)
+{
+    int header = snprintf(buf, size, "%" PRIu64 " %" PRId64 " ", event->seq, event->ts);
+    if (header < 0) return header;
+    size_t offset = (size_t)header < size ? (size_t)header : size;
+    int length;
+    switch (event->type)
+    {
+        case LOG_SENSOR_OPENED:
+        case LOG_SENSOR_CLOSED:
+        case LOG_SENSOR_INVALID:
+            length = snprintf(buf + offset, size - offset, event_types[event->type].format, event->sensor_id);
+            break;
+        case LOG_TOO_COLD:
+        case LOG_TOO_HOT:
+        case LOG_STILL_TOO_COLD:
+        case LOG_STILL_TOO_HOT:
+        case LOG_BACK_TO_NORMAL:
+            length = snprintf(buf + offset, size - offset, event_types[event->type].format, event->sensor_id, event->value);
+            break;
+        case LOG_ANOMALY:
+            length = snprintf(buf + offset, size - offset, event_types[event->type].format, event->sensor_id, event->detail, event->value, event->data_ts);
+            break;
+        case LOG_DB_REPLAYED:
+        case LOG_STORE_FAILED:
+        case LOG_DROPPED:
+        case LOG_DB_QUARANTINED:
+            length = snprintf(buf + offset, size - offset, event_types[event->type].format, event->count);
+            break;
+        default:
+            if (event->type < LOG_EVENT_COUNT)
+            {
+                length = snprintf(buf + offset, size - offset, "%s", event_types[event->type].format);
+            } else
+            {
+                length = snprintf(buf + offset, size - offset, "Unknown event %" PRIu16 ".", event->type);
+            }
+            break;
+    }
+    return length < 0 ? length : header + length;
+}
@@ -0,0 +1,177 @@
+/**
+ * \author Koen Eelen
+ */
+
+#ifndef _LOGGER_H_
+#define _LOGGER_H_
+
+#include <stddef.h>
+#include <stdbool.h>
+#include "config.h"
+
+/*
+ * Binary event log, gateway_logdump renders it as text
+ */
+#ifndef LOG_FILE
+#define LOG_FILE "gateway.events"
+#endif
+
+/*
+ * Number of records in the log ring, must be a power of 2. An event that finds the ring full is dropped and counted.
+ */
+#ifndef LOG_RING_SIZE
+#define LOG_RING_SIZE 1024
+#endif
+
+/*
+ * The writer polls the ring every LOG_FLUSH_MS ms when it's idle
+ */
+#ifndef LOG_FLUSH_MS
+#define LOG_FLUSH_MS 50
+#endif
+
+/*
+ * The writer collects the records in a buffer of LOG_BUFFER_SIZE bytes and writes it to the file when it's full,
+ * or LOG_FLUSH_MS ms after the first record of the buffer arrived
+ */
+#ifndef LOG_BUFFER_SIZE
+#define LOG_BUFFER_SIZE 65536
+#endif
+
+/*
+ * Rotation: once the log file reaches LOG_ROTATE_SIZE bytes or is LOG_ROTATE_SECONDS s old, it is renamed to
+ * LOG_FILE.1 (LOG_FILE.1 to LOG_FILE.2, ...) and a new LOG_FILE is started. LOG_KEEP rotated files are kept.
+ * A limit of 0 disables that kind of rotation.
+ */
+#ifndef LOG_ROTATE_SIZE
+#define LOG_ROTATE_SIZE (4 * 1024 * 1024)
+#endif
+
+#ifndef LOG_ROTATE_SECONDS
+#define LOG_ROTATE_SECONDS 0
+#endif
+
+#ifndef LOG_KEEP
+#define LOG_KEEP 4
+#endif
+
+/*
+ * When the log file is synced to disk:
+ *  LOG_FSYNC_NONE: never, left to the kernel
+ *  LOG_FSYNC_BATCH: after every write of the buffer
+ *  LOG_FSYNC_INTERVAL: at most every LOG_FSYNC_MS ms, if something was written
+ */
+#define LOG_FSYNC_NONE 0
+#define LOG_FSYNC_BATCH 1
+#define LOG_FSYNC_INTERVAL 2
+
+#ifndef LOG_FSYNC
+#define LOG_FSYNC LOG_FSYNC_INTERVAL
+#endif
+
+#ifndef LOG_FSYNC_MS
+#define LOG_FSYNC_MS 1000
+#endif
+
+typedef enum {
+    LOG_SENSOR_OPENED,              /**< sensor_id */
+    LOG_SENSOR_CLOSED,              /**< sensor_id */
+    LOG_SENSOR_INVALID,             /**< sensor_id */
+    LOG_THRESHOLDS_RELOADED,
+    LOG_TOO_COLD,                   /**< sensor_id, value: running avg */
+    LOG_TOO_HOT,                    /**< sensor_id, value: running avg */
+    LOG_STILL_TOO_COLD,             /**< sensor_id, value: running avg */
+    LOG_STILL_TOO_HOT,              /**< sensor_id, value: running avg */
+    LOG_BACK_TO_NORMAL,             /**< sensor_id, value: running avg */
+    LOG_ANOMALY,                    /**< sensor_id, value: detail, data_ts, detail: the detector */
+    LOG_DB_UNAVAILABLE,
+    LOG_DB_TABLE_CREATED,
+    LOG_DB_CONNECTED,
+    LOG_DB_LOST,
+    LOG_DB_RECONNECTING,
+    LOG_DB_REPLAYED,                /**< count: rows */
+    LOG_TSDB_OPENED,
+    LOG_STORE_FAILED,               /**< count: rows */
+    LOG_DROPPED,                    /**< count: dropped events */
+    LOG_DB_QUARANTINED,             /**< count: rows */
+    LOG_DB_CORRUPT,
+    LOG_EVENT_COUNT
+} log_event_type_t;
+
+/**
+ * One record of the log file, 'seq' is assigned by the writer so it numbers the events in file order
+ */
+typedef struct {
+    uint64_t seq;
+    int64_t ts;
+    uint16_t type;                  /**< a log_event_type_t */
+    uint16_t sensor_id;
+    uint32_t count;
+    double value;
+    int64_t data_ts;
+    char detail[24];
+} log_event_t;
+
+/*
+ * Every log file starts with this header, followed by log_event_t records
+ */
+#define LOG_MAGIC 0x5645574c        // "LWEV" on little-endian
+#define LOG_VERSION 1
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t record_size;
+} log_file_header_t;
+
+/**
+ * Opens 'path' and starts the writer thread
+ * \param path the log file, new events are appended. A file with another version of log_event_t is rotated first.
+ * \return zero for success, and non-zero if an error occurs
+ */
+int logger_init(const char *path);
+
+/**
+ * Stores an event in a free record of the log ring, never blocks: the event is dropped if the ring is full
+ * Safe to call from any thread, does nothing before logger_init()
+ * \param type the event
+ * \param sensor_id the sensor the event is about, 0 if none
+ * \param count a row or event count, 0 if none
+ * \param value a temperature, 0 if none
+ */
+void logger_event(log_event_type_t type, sensor_id_t sensor_id, uint32_t count, double value);
+
+/**
+ * Stores a LOG_ANOMALY event, see logger_event()
+ * \param sensor_id the sensor of the anomalous reading
+ * \param detector the name of the detector, truncated to fit log_event_t
+ * \param detail the value that triggered the detector
+ * \param ts the timestamp of the reading
+ */
+void logger_anomaly(sensor_id_t sensor_id, const char *detector, double detail, sensor_ts_t ts);
+
+/**
+ * \return the number of events dropped since logger_init()
+ */
+unsigned long logger_get_drops();
+
+/**
+ * Writes out everything still in the ring, stops the writer thread and closes the log file
+ */
+void logger_free();
+
+/**
+ * Renders an event as a line of the text log: "<sequence number> <timestamp> <message>"
+ * \param event the event
+ * \param buf the line is written here, without a trailing newline
+ * \param size the size of 'buf'
+ * \return the length of the line, like snprintf()
+ */
+int logger_format_event(const log_event_t *event, char *buf, size_t size);
+
+/**
+ * \return the short name of an event type (used by gateway_logdump -t), NULL for an unknown type
+ */
+const char *logger_event_name(int type);
+
+#endif /* _LOGGER_H_ */
@@ -4,15 +4,17 @@
 #include "sbuffer.h"
 #include "datamgr.h"
 #include "sensor_db.h"
+#include "storage_sink.h"
+#include "logger.h"
 #include <unistd.h>
 #include <stdio.h>
 #include <string.h>
 
-#define MAX 100
 #define STORAGEMGR_ID 11
 #define DATAMGR_ID 22
 
 int port;
+const storage_sink_t *sink;
 sbuffer_t *sbuffer;
 pthread_t connmgr_thread, datamgr_thread, storagemgr_thread;
 
@@ -23,7 +25,7 @@ void *start_connmgr(){
 }
 
 void *start_datamgr(){
-    FILE *fp = fopen("room_sensor.map", "r");
+    FILE *fp = fopen(SENSOR_MAP_FILE, "r");
     datamgr_parse_from_buffer(fp, sbuffer, DATAMGR_ID);
     datamgr_free();
     fclose(fp);
@@ -31,59 +33,50 @@ void *start_datamgr(){
 }
 
 void *start_storagemgr(){
-    DBCONN *conn = init_connection(1, sbuffer);
-    if(conn != NULL){
-        insert_sensor_from_buffer(conn, sbuffer, STORAGEMGR_ID);
-        disconnect(conn);
+    void *state = sink->open(sbuffer);
+    if(state != NULL){
+        storage_stats_t stats;
+        storage_sink_consume(sink, state, sbuffer, STORAGEMGR_ID, &stats);
+        printf("STORAGEMGR: %lu rows in %lu batches to %s, max commit %.1f ms, %lu swap waits (%.1f ms), %lu spooled, %lu replayed, %lu quarantined\n",
+               stats.rows, stats.batches, sink->name, stats.max_commit_ms, stats.swap_waits, stats.swap_wait_ms, stats.spooled, stats.replayed,
+               stats.quarantined);
+        sink->close(state);
     }
     pthread_exit(0);
 }
 
 int main(int argc, char *argv[])
 {
-    if (argc != 2)
+    if (argc != 2 && argc != 3)
     {
         printf("Error: no port given.\n");
+        printf("Usage: %s port [sqlite|tsdb|file|null]\n", argv[0]);
         exit(EXIT_SUCCESS);
     }
 
     port = atoi(argv[1]);
-    int pfds[2];
-    int result;
-    char * write_buffer;
-    result = pipe(pfds);
-
-    pid_t child_pid;
-    child_pid = fork();
-
-    if(child_pid == 0)
+    sink = storage_sink_find(argc == 3 ? argv[2] : "sqlite");
+    if (sink == NULL)
+    {
+        printf("Error: unknown storage sink %s.\n", argv[2]);
+        exit(EXIT_SUCCESS);
+    }
+    if (logger_init(LOG_FILE) != 0)
     {
-        //child code
-        char recv_buf[MAX];
-        close(pfds[1]);
-        FILE * log = fopen("gateway.log", "w");
-        int sequence = 0;
-        do
-        {
-            result = read(pfds[0], recv_buf, MAX);
-            asprintf(&write_buffer, "%d %ld %s\n", sequence, time(NULL), recv_buf);
-            fwrite(write_buffer, strlen(write_buffer), 1, log);
-            free(write_buffer);
-            sequence++;
-        } while (result > 0);
-        close(pfds[0]);
-        fclose(log);
-    } else {
-        sbuffer_init(&sbuffer);
-        sbuffer_insert_consumer_id(sbuffer, DATAMGR_ID);
-        sbuffer_insert_consumer_id(sbuffer, STORAGEMGR_ID);
-        sbuffer_add_pfds(sbuffer, pfds);
-        pthread_create(&connmgr_thread, NULL, start_connmgr, NULL);
-        pthread_create(&datamgr_thread, NULL, start_datamgr, NULL);
-        pthread_create(&storagemgr_thread, NULL, start_storagemgr, NULL);
-        pthread_join(connmgr_thread, NULL);
-        pthread_join(datamgr_thread, NULL);
-        pthread_join(storagemgr_thread, NULL);
+        printf("Error: can't open %s.\n", LOG_FILE);
+        exit(EXIT_FAILURE);
     }
+
+    sbuffer_init(&sbuffer);
+    sbuffer_insert_consumer_id(sbuffer, DATAMGR_ID);
+    sbuffer_insert_consumer_id(sbuffer, STORAGEMGR_ID);
+    pthread_create(&connmgr_thread, NULL, start_connmgr, NULL);
+    pthread_create(&datamgr_thread, NULL, start_datamgr, NULL);
+    pthread_create(&storagemgr_thread, NULL, start_storagemgr, NULL);
+    pthread_join(connmgr_thread, NULL);
+    pthread_join(datamgr_thread, NULL);
+    pthread_join(storagemgr_thread, NULL);
+    if (logger_get_drops() > 0) printf("LOGGER: %lu messages dropped\n", logger_get_drops());
+    logger_free();
     sbuffer_free(&sbuffer);
 }
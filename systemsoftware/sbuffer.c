@@ -9,6 +9,7 @@
 #include <semaphore.h>
 #include <pthread.h>
 #include <inttypes.h>
+#include <time.h>
 #ifndef NUMBER_OF_CONSUMERS
 #define NUMBER_OF_CONSUMERS 2
 #endif
@@ -18,7 +19,7 @@
  */
 typedef struct sbuffer_node {
     struct sbuffer_node *next;  /**< a pointer to the next node*/
-    sensor_data_t data;         /**< a structure containing the data */
+    sensor_record_t data;       /**< the data, packed relative to the epoch of the buffer */
     int consumed_by[NUMBER_OF_CONSUMERS];
 } sbuffer_node_t;
 
@@ -29,8 +30,8 @@ struct sbuffer {
     sbuffer_node_t *head;       /**< a pointer to the first node in the buffer */
     sbuffer_node_t *tail;       /**< a pointer to the last node in the buffer */
     bool terminate;
+    sensor_ts_t epoch;          /**< time the buffer was created, timestamps are stored relative to it */
     pthread_rwlock_t * lock;
-    int pfds[2];
     sem_t consumer_locks[NUMBER_OF_CONSUMERS];
     int consumer_ids[NUMBER_OF_CONSUMERS];
 };
@@ -53,6 +54,7 @@ int sbuffer_init(sbuffer_t **buffer) {
     (*buffer)->head = NULL;
     (*buffer)->tail = NULL;
     (*buffer)->terminate = false;
+    (*buffer)->epoch = time(NULL);
     (*buffer)->lock = malloc(sizeof(pthread_rwlock_t));
     pthread_rwlock_init((*buffer)->lock, NULL);
     for(int i = 0; i<sizeof((*buffer)->consumer_ids)/sizeof(int); i++)
@@ -81,6 +83,7 @@ int sbuffer_free(sbuffer_t **buffer) {
 
 int sbuffer_consume(sbuffer_t *buffer, sensor_data_t *data, int consumer_id)
 {
+    if (buffer == NULL) return SBUFFER_FAILURE;
     int index = -1;
     for(int i = 0; i<sizeof(buffer->consumer_ids)/sizeof(int); i++)
     {
@@ -89,57 +92,41 @@ int sbuffer_consume(sbuffer_t *buffer, sensor_data_t *data, int consumer_id)
             index = i;
         }
     }
-    if (buffer->head == NULL) 
+    if(index == -1) return SBUFFER_FAILURE;
+
+    //every insert posts once for every consumer, so a successful wait means there's a node this consumer hasn't
+    //read yet; once terminated the remaining nodes are handed out without waiting
+    if(!buffer->terminate)
     {
-        if(!buffer->terminate) sem_wait(&(buffer->consumer_locks[index]));
-        return SBUFFER_NO_DATA;
+        struct timespec until;
+        clock_gettime(CLOCK_REALTIME, &until);
+        until.tv_nsec += (SBUFFER_POLL_MS % 1000) * 1000000L;
+        until.tv_sec += SBUFFER_POLL_MS / 1000 + until.tv_nsec / 1000000000L;
+        until.tv_nsec %= 1000000000L;
+        if (sem_timedwait(&(buffer->consumer_locks[index]), &until) != 0) return SBUFFER_NO_DATA;
     }
-    if(!buffer->terminate) sem_wait(&(buffer->consumer_locks[index]));
 
-    if (buffer == NULL) return SBUFFER_FAILURE;
     pthread_rwlock_wrlock(buffer->lock);
-    index = -1;
-    for(int i = 0; i<sizeof(buffer->consumer_ids)/sizeof(int); i++)
+    sbuffer_node_t * dummy = buffer->head;
+    while(dummy != NULL && dummy->consumed_by[index] == consumer_id)
     {
-        if (buffer->consumer_ids[i] == consumer_id)
-        {
-            index = i;
-        }
+        dummy = dummy->next;
     }
-    if(index == -1) 
+    if (dummy == NULL)
     {
         pthread_rwlock_unlock(buffer->lock);
-        return SBUFFER_FAILURE;
-    }
-    if (buffer->head == NULL) 
-    {
         return SBUFFER_NO_DATA;
-        pthread_rwlock_unlock(buffer->lock);
     }
-    sbuffer_node_t * dummy = buffer->head;
-    while(dummy->consumed_by[index] == consumer_id && dummy != buffer->tail)
-    {
-        dummy = dummy->next;
-    } 
 
     dummy->consumed_by[index] = consumer_id;
-    *data = dummy->data;
-    for(int i = 0; i<sizeof(buffer->consumer_ids)/sizeof(int); i++)
+    sensor_record_unpack(data, &dummy->data, buffer->epoch);
+    //the consumers read in order, so only the head can be read by all of them
+    bool read_by_all = dummy == buffer->head;
+    for(int i = 0; read_by_all && i<sizeof(buffer->consumer_ids)/sizeof(int); i++)
     {
-        if(dummy->consumed_by[i] != buffer->consumer_ids[i]) 
-        {
-            pthread_rwlock_unlock(buffer->lock);
-            return SBUFFER_SUCCESS;
-        }
-        if (buffer->terminate && dummy == buffer->tail)
-        {
-            pthread_rwlock_unlock(buffer->lock);
-            return SBUFFER_FAILURE;
-        }
+        if(dummy->consumed_by[i] != buffer->consumer_ids[i]) read_by_all = false;
     }
-    sbuffer_pop(buffer);
-    //printf("-----------BUFFER AFTER POP");
-    //_sbuffer_print_content(buffer);
+    if (read_by_all) sbuffer_pop(buffer);
     pthread_rwlock_unlock(buffer->lock);
     return SBUFFER_SUCCESS;
 }
@@ -160,12 +147,11 @@ int sbuffer_insert(sbuffer_t *buffer, sensor_data_t *data) {
     if (buffer == NULL) return SBUFFER_FAILURE;
     sbuffer_node_t *dummy;
     dummy = malloc(sizeof(sbuffer_node_t));
-    dummy->data = *data;
+    sensor_record_pack(&dummy->data, data, buffer->epoch);
     dummy->next = NULL;
     for(int i = 0; i<sizeof(buffer->consumer_ids)/sizeof(int); i++)
     {
         dummy->consumed_by[i] = 0;
-        sem_post(&(buffer->consumer_locks[i]));
     }
     pthread_rwlock_wrlock(buffer->lock);
     if (buffer->tail == NULL)
@@ -179,6 +165,11 @@ int sbuffer_insert(sbuffer_t *buffer, sensor_data_t *data) {
     //printf("-----------BUFFER AFTER INSERT");
     //_sbuffer_print_content(buffer);
     pthread_rwlock_unlock(buffer->lock);
+    //posted once the node is linked in, a consumer that wakes up always finds it
+    for(int i = 0; i<sizeof(buffer->consumer_ids)/sizeof(int); i++)
+    {
+        sem_post(&(buffer->consumer_locks[i]));
+    }
     return SBUFFER_SUCCESS;
 }
 
@@ -188,7 +179,7 @@ void _sbuffer_print_content(sbuffer_t * buffer)
     sbuffer_node_t * dummy = buffer->head;
     for(int i = 0; dummy != NULL; dummy = dummy->next, i++)
     {
-        printf("%d: %p | %p | %"PRIu16" - %g - %ld, [r1,r2]=[%d, %d]\n", i, dummy, dummy->next, dummy->data.id, dummy->data.value, dummy->data.ts, dummy->consumed_by[0], dummy->consumed_by[1]);
+        printf("%d: %p | %p | %"PRIu16" - %g - %ld, [r1,r2]=[%d, %d]\n", i, dummy, dummy->next, dummy->data.id, (double)dummy->data.value, (long)dummy->data.ts, dummy->consumed_by[0], dummy->consumed_by[1]);
     }
     printf("\n");
     fflush(stdout);
@@ -203,16 +194,3 @@ void sbuffer_remove_locks(sbuffer_t * buffer)
         sem_post(&(buffer->consumer_locks[i]));
     }
 }
-
-void sbuffer_add_pfds(sbuffer_t * buffer, int pfds[])
-{
-    for(int i = 0; i<sizeof(buffer->consumer_ids)/sizeof(int); i++)
-    {
-        buffer->pfds[i] = pfds[i];
-    }
-}
-
-int sbuffer_get_pfd(sbuffer_t * buffer)
-{
-    return buffer->pfds[1];
-}
@@ -13,6 +13,13 @@
 #define SBUFFER_NO_DATA 1
 #define SBUFFER_ALL_DATA_READ 2
 
+/*
+ * Max time (in ms) sbuffer_consume() waits for new data on an empty buffer, so consumers can do periodic work
+ */
+#ifndef SBUFFER_POLL_MS
+#define SBUFFER_POLL_MS 100
+#endif
+
 typedef struct sbuffer sbuffer_t;
 
 /**
@@ -38,6 +45,16 @@ int sbuffer_free(sbuffer_t **buffer);
  */
 int sbuffer_remove(sbuffer_t *buffer, sensor_data_t *data);
 
+/**
+ * Copies the oldest sensor data in 'buffer' that 'consumer_id' hasn't read yet into '*data'
+ * The sensor data is removed from the buffer once every consumer has read it
+ * If there's no data, the function waits at most SBUFFER_POLL_MS for new data and returns SBUFFER_NO_DATA
+ * After sbuffer_remove_locks() the function doesn't wait anymore, the data that's left is still handed out
+ * \param buffer a pointer to the buffer that is used
+ * \param data a pointer to pre-allocated sensor_data_t space, the data will be copied into this structure
+ * \param consumer_id the id the consumer registered with sbuffer_insert_consumer_id()
+ * \return SBUFFER_SUCCESS on success, SBUFFER_NO_DATA if there's no data and SBUFFER_FAILURE if an error occurred
+ */
 int sbuffer_consume(sbuffer_t *buffer, sensor_data_t *data, int consumer_id);
 
 void sbuffer_pop(sbuffer_t *buffer);
@@ -61,8 +78,4 @@ void sbuffer_insert_consumer_id(sbuffer_t *buffer, int consumer_id);
 
 void sbuffer_remove_locks(sbuffer_t * buffer);
 
-void sbuffer_add_pfds(sbuffer_t * buffer, int pfds[]);
-
-int sbuffer_get_pfd(sbuffer_t * buffer);
-
 #endif  //_SBUFFER_H_
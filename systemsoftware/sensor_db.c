@@ -7,219 +7,1061 @@
 #include <stdlib.h>
 #include "config.h"
 #include "sensor_db.h"
+#include "sensor_tsdb.h"
+#include "logger.h"
 #include <sqlite3.h>
 #include <string.h>
 #include <inttypes.h>
 #include <unistd.h>
+#include <time.h>
+#include <assert.h>
+#include <pthread.h>
 
 
+#define SELECT_COLUMNS "SELECT id, sensor_id, sensor_value, sensor_time, upload_time FROM "TO_STRING(TABLE_NAME)
+
+typedef enum {
+    QUERY_ALL, QUERY_BY_VALUE, QUERY_EXCEED_VALUE, QUERY_BY_TIMESTAMP, QUERY_AFTER_TIMESTAMP,
+    QUERY_BY_ID, QUERY_TIME_RANGE, QUERY_ID_TIME_RANGE, QUERY_VALUE_RANGE, QUERY_ROLLUP_MINUTE, QUERY_ROLLUP_HOUR,
+    QUERY_COUNT
+} query_t;
+
+#define ROLLUP_TABLE(suffix) TO_STRING(TABLE_NAME)"_"#suffix
+#define ROLLUP_SCHEMA(suffix) \
+    "CREATE TABLE IF NOT EXISTS "ROLLUP_TABLE(suffix)"(sensor_id INTEGER, bucket TIMESTAMP, value_min REAL, value_max REAL, " \
+    "value_sum REAL, value_count INTEGER, PRIMARY KEY(sensor_id, bucket)) WITHOUT ROWID;"
+#define ROLLUP_UPSERT(suffix) \
+    "INSERT INTO "ROLLUP_TABLE(suffix)"(sensor_id, bucket, value_min, value_max, value_sum, value_count) VALUES(?1, ?2, ?3, ?3, ?3, 1) " \
+    "ON CONFLICT(sensor_id, bucket) DO UPDATE SET value_min = min(value_min, excluded.value_min), " \
+    "value_max = max(value_max, excluded.value_max), value_sum = value_sum + excluded.value_sum, value_count = value_count + 1;"
+#define ROLLUP_SELECT(suffix) \
+    "SELECT sensor_id, bucket, value_min, value_max, value_sum / value_count AS value_mean, value_count FROM "ROLLUP_TABLE(suffix) \
+    " WHERE sensor_id = ?1 AND bucket BETWEEN ?2 AND ?3 ORDER BY bucket;"
+
+static const char *rollup_upsert_sql[ROLLUP_COUNT] = {ROLLUP_UPSERT(1m), ROLLUP_UPSERT(1h)};
+static const int rollup_seconds[ROLLUP_COUNT] = {60, 3600};
+
+static const char *query_sql[QUERY_COUNT] = {
+    [QUERY_ALL]             = SELECT_COLUMNS";",
+    [QUERY_BY_VALUE]        = SELECT_COLUMNS" WHERE sensor_value = ?1;",
+    [QUERY_EXCEED_VALUE]    = SELECT_COLUMNS" WHERE sensor_value > ?1;",
+    [QUERY_BY_TIMESTAMP]    = SELECT_COLUMNS" WHERE sensor_time = ?1;",
+    [QUERY_AFTER_TIMESTAMP] = SELECT_COLUMNS" WHERE sensor_time > ?1;",
+    [QUERY_BY_ID]           = SELECT_COLUMNS" WHERE sensor_id = ?1 ORDER BY sensor_time;",
+    [QUERY_TIME_RANGE]      = SELECT_COLUMNS" WHERE sensor_time BETWEEN ?1 AND ?2 ORDER BY sensor_time;",
+    [QUERY_ID_TIME_RANGE]   = SELECT_COLUMNS" WHERE sensor_id = ?1 AND sensor_time BETWEEN ?2 AND ?3 ORDER BY sensor_time;",
+    [QUERY_VALUE_RANGE]     = SELECT_COLUMNS" WHERE sensor_value BETWEEN ?1 AND ?2;",
+    [QUERY_ROLLUP_MINUTE]   = ROLLUP_SELECT(1m),
+    [QUERY_ROLLUP_HOUR]     = ROLLUP_SELECT(1h),
+};
+
+/**
+ * A connection keeps its insert statement and queries prepared for as long as the database is open
+ */
+struct dbconn {
+    sqlite3 *db;                    /**< NULL for a STORAGE_TSDB connection */
+    tsdb_t *tsdb;                   /**< NULL for a STORAGE_SQLITE connection */
+    char clear_up_flag;             /**< cleared once the tables have been dropped */
+    bool read_only;                 /**< a pool connection, inserts fail */
+    sqlite3_stmt *insert_stmt;
+    sqlite3_stmt *rollup_stmts[ROLLUP_COUNT];  /**< upserts into the rollup tables */
+    sqlite3_stmt *prune_stmt;
+    time_t next_prune;              /**< earliest time for the next prune when the previous one found nothing left */
+    sensor_data_t pending_rows[DB_BATCH_SIZE];  /**< rows of insert_sensor() that aren't committed yet */
+    int pending;
+    struct timespec batch_start;    /**< time at which the first pending row was added */
+    FILE *spool;                    /**< open while rows are being spooled, NULL otherwise */
+    sensor_ts_t spool_epoch;
+    time_t next_reconnect;          /**< earliest time for the next attempt to open the database */
+    int reconnect_delay;            /**< backoff in sec after the next failed attempt */
+    sqlite3_stmt *queries[QUERY_COUNT];  /**< prepared on first use, kept until disconnect */
+    pthread_mutex_t stats_lock;
+    storage_stats_t stats;
+};
+
+/**
+ * A streaming query owns its statement, so several can be open on one connection
+ */
+struct sensor_db_query {
+    DBCONN *conn;
+    sqlite3_stmt *stmt;
+    int batch_size;
+    bool done;
+    sensor_data_t rows[];
+};
+
+/**
+ * The free connections form a stack, a borrower waits on 'cond' while it is empty
+ */
+struct sensor_db_pool {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int size;
+    int available;                  /**< number of connections in 'free' */
+    DBCONN **free;
+    sensor_db_pool_stats_t stats;
+};
+
 typedef int (*callback_t)(void *, int, char **, char **);
-int execute_query(DBCONN *conn, char * query, callback_t f);
+static DBCONN *init_tsdb_connection();
+static int open_database(DBCONN *conn);
+static void close_database(DBCONN *conn);
+static int write_batch(DBCONN *conn, sensor_data_t *rows, int count);
+static int commit_rows(DBCONN *conn, sensor_data_t *rows, int count);
+static int spool_rows(DBCONN *conn, sensor_data_t *rows, int count);
+static bool is_connection_error(int rc);
+static bool is_corrupt_error(int rc);
+static void rotate_corrupt_database(DBCONN *conn);
+static int quarantine_rows(DBCONN *conn, sensor_data_t *rows, int count, int rc);
+static void schedule_reconnect(DBCONN *conn);
+static int reconnect(DBCONN *conn);
+static int replay_spool(DBCONN *conn);
+static int query_tsdb(DBCONN *conn, sensor_id_t id, sensor_ts_t from, sensor_ts_t to, callback_t f);
+static sqlite3_stmt *get_query(DBCONN *conn, query_t query);
+static int execute_query(DBCONN *conn, sqlite3_stmt *stmt, callback_t f);
+static double elapsed_ms(struct timespec *since);
+static int insert_row(DBCONN *conn, sensor_id_t id, sensor_value_t value, sensor_ts_t ts, time_t upload_time);
+static void prune_sensor(DBCONN *conn);
 
 DBCONN *init_connection(char clear_up_flag, sbuffer_t * sbuffer)
+{
+    if (STORAGE_BACKEND == STORAGE_TSDB) return init_tsdb_connection();
+
+    DBCONN *conn = calloc(1, sizeof(DBCONN));
+    assert(conn != NULL);
+    conn->clear_up_flag = clear_up_flag;
+    conn->reconnect_delay = DB_RECONNECT_MIN;
+    pthread_mutex_init(&conn->stats_lock, NULL);
+
+    //a failed open leaves conn->db NULL, inserts are spooled until reconnect() succeeds
+    if (open_database(conn) == 0) replay_spool(conn);
+    else schedule_reconnect(conn);
+    return conn;
+}
+
+
+/*
+ * Opens DB_NAME, creates the tables and prepares the insert statements, on failure everything is closed again
+ * \return zero for success, and non-zero if an error occurs
+ */
+static int open_database(DBCONN *conn)
 {
     sqlite3 *db;
     char *err_msg = 0;
     char *sql;
-    char *msg;
-    
+
     int rc = sqlite3_open(TO_STRING(DB_NAME), &db);
 
     //check if connection succesful
     if (rc != SQLITE_OK)
     {
         printf("Unable to connect to SQL server.\n");
-        asprintf(&msg, "Unable to connect to SQL server.");
-        write(sbuffer_get_pfd(sbuffer), msg, strlen(msg)+1);
-        free(msg);
-        return NULL;
-        int i = 0;
-        while(rc != SQLITE_OK && i < 2)
-        {
-            sqlite3_free(err_msg);
-            sqlite3_close(db);
-            printf("Reconnecting to SQL server.\n");
-            asprintf(&msg, "Reconnecting to SQL server.");
-            write(sbuffer_get_pfd(sbuffer), msg, strlen(msg)+1);
-            free(msg);
-            rc = sqlite3_open(TO_STRING(DB_NAME), &db);
-            i++;
-            sleep(5);
-        }
-        if(i == 1 && rc != SQLITE_OK)
-        {
-            printf("Connection to SQL server could not be established.\n");
-            asprintf(&msg, "Connection to SQL server could not be established.");
-            write(sbuffer_get_pfd(sbuffer), msg, strlen(msg)+1);
-            free(msg);
-            sbuffer_remove_locks(sbuffer);
-        }
+        logger_event(LOG_DB_UNAVAILABLE, 0, 0, 0);
+        sqlite3_close(db);
+        return 1;
     }
 
     //initiate sql statement in case 
-    if(clear_up_flag)
-    {
-        sql = 
-            "DROP TABLE IF EXISTS "TO_STRING(TABLE_NAME)";"
-            "CREATE TABLE "TO_STRING(TABLE_NAME)"(id INTEGER PRIMARY KEY AUTOINCREMENT, sensor_id INTEGER, sensor_value DECIMAL(4,2), sensor_time TIMESTAMP, upload_time TIMESTAMP);";
-    } else
+    sql =
+        "CREATE TABLE IF NOT EXISTS "TO_STRING(TABLE_NAME)"(id INTEGER PRIMARY KEY AUTOINCREMENT, sensor_id INTEGER, sensor_value DECIMAL(4,2), sensor_time TIMESTAMP, upload_time TIMESTAMP);"
+        "CREATE INDEX IF NOT EXISTS "TO_STRING(TABLE_NAME)"_sensor_time ON "TO_STRING(TABLE_NAME)"(sensor_id, sensor_time);"
+        "CREATE INDEX IF NOT EXISTS "TO_STRING(TABLE_NAME)"_time ON "TO_STRING(TABLE_NAME)"(sensor_time);"
+        ROLLUP_SCHEMA(1m)
+        ROLLUP_SCHEMA(1h);
+    //execute sql stuff and check for errors
+    rc = sqlite3_exec(db, "PRAGMA journal_mode=WAL; PRAGMA synchronous="TO_STRING(DB_SYNCHRONOUS)";", 0, 0, &err_msg);
+    if (rc == SQLITE_OK && conn->clear_up_flag)
     {
-        sql = "CREATE TABLE IF NOT EXISTS "TO_STRING(TABLE_NAME)"(id INTEGER PRIMARY KEY AUTOINCREMENT, sensor_id INTEGER, sensor_value DECIMAL(4,2), timestamp TIMESTAMP, upload_time TIMESTAMP);";
+        rc = sqlite3_exec(db, "DROP TABLE IF EXISTS "TO_STRING(TABLE_NAME)";"
+                              "DROP TABLE IF EXISTS "ROLLUP_TABLE(1m)";"
+                              "DROP TABLE IF EXISTS "ROLLUP_TABLE(1h)";", 0, 0, &err_msg);
     }
-    //execute sql stuff and check for errors
-    rc = sqlite3_exec(db, sql, 0, 0, &err_msg);
+    if (rc == SQLITE_OK) rc = sqlite3_exec(db, sql, 0, 0, &err_msg);
     if (rc != SQLITE_OK)
     {
         fprintf(stderr, "Cannot open database: %s\n", sqlite3_errmsg(db));
         sqlite3_free(err_msg);
         sqlite3_close(db);
-        return NULL;
+        if (is_corrupt_error(rc & 0xff)) rotate_corrupt_database(conn);
+        return 1;
+    }
+
+    conn->db = db;
+    sql = "INSERT INTO "TO_STRING(TABLE_NAME)"(sensor_id, sensor_value, sensor_time, upload_time) VALUES(?1, ?2, ?3, ?4);";
+    rc = sqlite3_prepare_v2(db, sql, -1, &conn->insert_stmt, 0);
+    for (int i = 0; i < ROLLUP_COUNT; i++)
+    {
+        if (rc == SQLITE_OK) rc = sqlite3_prepare_v2(db, rollup_upsert_sql[i], -1, &conn->rollup_stmts[i], 0);
+    }
+    sql = "DELETE FROM "TO_STRING(TABLE_NAME)" WHERE id IN "
+          "(SELECT id FROM "TO_STRING(TABLE_NAME)" WHERE sensor_time < ?1 ORDER BY sensor_time LIMIT ?2);";
+    if (rc == SQLITE_OK) rc = sqlite3_prepare_v2(db, sql, -1, &conn->prune_stmt, 0);
+    if (rc != SQLITE_OK)
+    {
+        fprintf(stderr, "Failed to prepare statement: %s\n", sqlite3_errmsg(db));
+        close_database(conn);
+        return 1;
+    }
+    //only the very first open may clear the tables, a reconnect must keep what was stored before
+    if (conn->clear_up_flag)
+    {
+        conn->clear_up_flag = 0;
+        printf("New table "TO_STRING(TABLE_NAME) " created.\n");
+        logger_event(LOG_DB_TABLE_CREATED, 0, 0, 0);
     }
-    printf("New table "TO_STRING(TABLE_NAME) " created.\n");
-    asprintf(&msg, "New table "TO_STRING(TABLE_NAME) " created.");
-    write(sbuffer_get_pfd(sbuffer), msg, strlen(msg)+1);
-    free(msg);
 
     printf("Connection to SQL server established.\n");
-    asprintf(&msg, "Connection to SQL server established.");
-    write(sbuffer_get_pfd(sbuffer), msg, strlen(msg)+1);
-    free(msg);
-    return db;
+    logger_event(LOG_DB_CONNECTED, 0, 0, 0);
+    return 0;
+}
+
+
+/*
+ * Finalizes every statement and closes the database, conn->db is NULL afterwards
+ */
+static void close_database(DBCONN *conn)
+{
+    sqlite3_finalize(conn->insert_stmt);
+    for (int i = 0; i < ROLLUP_COUNT; i++) sqlite3_finalize(conn->rollup_stmts[i]);
+    sqlite3_finalize(conn->prune_stmt);
+    for (int i = 0; i < QUERY_COUNT; i++) sqlite3_finalize(conn->queries[i]);
+    sqlite3_close(conn->db);
+    conn->db = NULL;
+    conn->insert_stmt = conn->prune_stmt = NULL;
+    memset(conn->rollup_stmts, 0, sizeof(conn->rollup_stmts));
+    memset(conn->queries, 0, sizeof(conn->queries));
+}
+
+
+/*
+ * A TSDB connection has no SQLite handle or statements, the store itself creates TSDB_DIR
+ */
+static DBCONN *init_tsdb_connection()
+{
+    tsdb_t *tsdb = tsdb_open(TO_STRING(TSDB_DIR));
+    if (tsdb == NULL)
+    {
+        fprintf(stderr, "Cannot open time-series store "TO_STRING(TSDB_DIR)"\n");
+        return NULL;
+    }
+    DBCONN *conn = calloc(1, sizeof(DBCONN));
+    assert(conn != NULL);
+    conn->tsdb = tsdb;
+    pthread_mutex_init(&conn->stats_lock, NULL);
+
+    printf("Time-series store "TO_STRING(TSDB_DIR)" opened.\n");
+    logger_event(LOG_TSDB_OPENED, 0, 0, 0);
+    return conn;
 }
 
 void disconnect(DBCONN *conn)
 {
-    sqlite3_close(conn);
+    if (conn->tsdb != NULL) tsdb_close(&conn->tsdb);
+    flush_sensor(conn);
+    if (conn->spool != NULL) fclose(conn->spool);
+    close_database(conn);
+    pthread_mutex_destroy(&conn->stats_lock);
+    free(conn);
 }
 
 
 int insert_sensor(DBCONN *conn, sensor_id_t id, sensor_value_t value, sensor_ts_t ts)
 {
-    char * sql = "INSERT INTO "TO_STRING(TABLE_NAME)"(sensor_id, sensor_value, sensor_time, upload_time) VALUES(@sensor_id, @sensor_value, @sensor_time, @upload_time);";
-    sqlite3_stmt *pStmt;
-    int rc = sqlite3_prepare_v2(conn, sql, -1, &pStmt, 0);
-    
-    if (rc != SQLITE_OK ) {
-        fprintf(stderr, "Failed to prepare statement\n");
-        fprintf(stderr, "Cannot open database: %s\n", sqlite3_errmsg(conn));
-        sqlite3_close(conn);
-        return 1;
-    } 
-    int sensor_id = sqlite3_bind_parameter_index(pStmt, "@sensor_id");
-    int sensor_value = sqlite3_bind_parameter_index(pStmt, "@sensor_value");
-    int sensor_time = sqlite3_bind_parameter_index(pStmt, "@sensor_time");
-    int upload_time = sqlite3_bind_parameter_index(pStmt, "@upload_time");
-    sqlite3_bind_int(pStmt, sensor_id, id);
-    sqlite3_bind_double(pStmt, sensor_value, value);
-    sqlite3_bind_int(pStmt, sensor_time, ts);
-    sqlite3_bind_int(pStmt, upload_time, time(NULL));
-
-    rc = sqlite3_step(pStmt);
-    if (rc != SQLITE_DONE) {
-        printf("execution failed: %s", sqlite3_errmsg(conn));
-        sqlite3_close(conn);
-        return 1;
+    if (conn->tsdb != NULL)
+    {
+        sensor_data_t data = {.id = id, .value = value, .ts = ts};
+        return tsdb_append(conn->tsdb, &data);
     }
-    sqlite3_finalize(pStmt); 
+
+    if (conn->pending == 0) clock_gettime(CLOCK_MONOTONIC, &conn->batch_start);
+    conn->pending_rows[conn->pending].id = id;
+    conn->pending_rows[conn->pending].value = value;
+    conn->pending_rows[conn->pending].ts = ts;
+    conn->pending++;
+
+    if (conn->pending >= DB_BATCH_SIZE || elapsed_ms(&conn->batch_start) >= DB_BATCH_MS) return flush_sensor(conn);
     return 0;
 }
 
 
-int insert_sensor_from_buffer(DBCONN *conn, sbuffer_t *sbuffer, int storagemgr_id)
+int flush_sensor(DBCONN *conn)
+{
+    if (conn->pending == 0) return 0;
+    int count = conn->pending;
+    conn->pending = 0;
+    return write_batch(conn, conn->pending_rows, count);
+}
+
+
+int insert_sensor_batch(DBCONN *conn, sensor_data_t *rows, int count)
 {
-    time_t last_upload = time(NULL);
-    bool terminate = false;
-    while(!terminate)
+    //a pending batch that fails must not keep this one from being written
+    int result = flush_sensor(conn);
+    return write_batch(conn, rows, count) | result;
+}
+
+
+/*
+ * Stores one batch in the TSDB, in SQLite or, while SQLite is unavailable, in the spool
+ */
+static int write_batch(DBCONN *conn, sensor_data_t *rows, int count)
+{
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    if (conn->read_only)
     {
-        sensor_data_t data; 
-        int reading = sbuffer_consume(sbuffer, &data, storagemgr_id);
-        if(reading==SBUFFER_SUCCESS)
+        fprintf(stderr, "Failed to insert batch: read-only connection\n");
+        return 1;
+    }
+    if (conn->tsdb != NULL)
+    {
+        for (int i = 0; i < count; i++)
         {
-            last_upload = time(NULL);
-            int s = insert_sensor(conn, data.id, data.value, data.ts);
-            if(s == 1)
-            {
-                char * msg;
-                printf("Connection to SQL server lost.\n");
-                asprintf(&msg, "Connection to SQL server lost.");
-                write(sbuffer_get_pfd(sbuffer), msg, strlen(msg)+1);
-                free(msg);
+            if (tsdb_append(conn->tsdb, &rows[i]) != 0) {
+                fprintf(stderr, "Failed to write block to "TO_STRING(TSDB_DIR)"\n");
+                return 1;
             }
         }
-
-        if(last_upload + TIMEOUT < time(NULL))
+    } else
+    {
+        if (conn->db == NULL && reconnect(conn) != 0) return spool_rows(conn, rows, count);
+        int rc = commit_rows(conn, rows, count);
+        if (rc != SQLITE_OK && is_corrupt_error(rc))
+        {
+            rotate_corrupt_database(conn);
+            schedule_reconnect(conn);
+            return spool_rows(conn, rows, count);
+        }
+        if (rc != SQLITE_OK && is_connection_error(rc))
+        {
+            printf("Connection to SQL server lost, spooling to "TO_STRING(DB_SPOOL_FILE)".\n");
+            logger_event(LOG_DB_LOST, 0, 0, 0);
+            close_database(conn);
+            schedule_reconnect(conn);
+            return spool_rows(conn, rows, count);
+        }
+        if (rc != SQLITE_OK)
         {
-            printf("STORAGEMGR TIMEOUT\n");
-            terminate = true;
+            quarantine_rows(conn, rows, count, rc);
+            return 1;
         }
     }
+
+    double commit_ms = elapsed_ms(&start);
+    pthread_mutex_lock(&conn->stats_lock);
+    conn->stats.batches++;
+    conn->stats.rows += count;
+    conn->stats.last_batch_size = count;
+    conn->stats.last_commit_ms = commit_ms;
+    conn->stats.total_commit_ms += commit_ms;
+    if (commit_ms > conn->stats.max_commit_ms) conn->stats.max_commit_ms = commit_ms;
+    pthread_mutex_unlock(&conn->stats_lock);
+
+    if (conn->db != NULL) prune_sensor(conn);
     return 0;
 }
 
 
-int find_sensor_all(DBCONN *conn, callback_t f)
+/*
+ * Inserts the rows in one transaction, rolled back if any of them fails
+ * \return SQLITE_OK for success, otherwise the primary result code of the statement that failed
+ */
+static int commit_rows(DBCONN *conn, sensor_data_t *rows, int count)
 {
-    char *err_msg = 0;
-    char *sql = "SELECT * FROM "TO_STRING(TABLE_NAME)";";
-        
-    int rc = sqlite3_exec(conn, sql, f, 0, &err_msg);
-    if (rc != SQLITE_OK ) {
-        
-        fprintf(stderr, "Failed to select data\n");
-        fprintf(stderr, "SQL error: %s\n", err_msg);
-        sqlite3_free(err_msg);
-        sqlite3_close(conn);
+    int rc = sqlite3_exec(conn->db, "BEGIN;", 0, 0, 0);
+    time_t upload_time = time(NULL);
+    for (int i = 0; rc == SQLITE_OK && i < count; i++)
+    {
+        rc = insert_row(conn, rows[i].id, rows[i].value, rows[i].ts, upload_time);
+        if (rc == SQLITE_DONE) rc = SQLITE_OK;
+    }
+    if (rc == SQLITE_OK) rc = sqlite3_exec(conn->db, "COMMIT;", 0, 0, 0);
+    if (rc != SQLITE_OK) {
+        fprintf(stderr, "Failed to insert batch: %s\n", sqlite3_errmsg(conn->db));
+        sqlite3_exec(conn->db, "ROLLBACK;", 0, 0, 0);
+    }
+    return rc & 0xff;
+}
+
+
+/*
+ * Errors that say nothing about the rows themselves, the same batch can succeed once the database is reachable again
+ * or the disk has room again
+ */
+static bool is_connection_error(int rc)
+{
+    switch (rc)
+    {
+        case SQLITE_BUSY:
+        case SQLITE_LOCKED:
+        case SQLITE_NOMEM:
+        case SQLITE_READONLY:
+        case SQLITE_IOERR:
+        case SQLITE_FULL:
+        case SQLITE_CANTOPEN:
+            return true;
+        default:
+            return false;
+    }
+}
+
+
+/*
+ * Errors of the database file itself, retrying on the same file fails forever
+ */
+static bool is_corrupt_error(int rc)
+{
+    return rc == SQLITE_CORRUPT || rc == SQLITE_NOTADB;
+}
+
+
+/*
+ * Closes the database and moves DB_NAME and its WAL out of the way, the next open_database() creates a fresh one
+ */
+static void rotate_corrupt_database(DBCONN *conn)
+{
+    printf("Database "TO_STRING(DB_NAME)" is corrupt, moved to "TO_STRING(DB_NAME)".corrupt.\n");
+    logger_event(LOG_DB_CORRUPT, 0, 0, 0);
+    if (conn->db != NULL) close_database(conn);
+    rename(TO_STRING(DB_NAME), TO_STRING(DB_NAME)".corrupt");
+    rename(TO_STRING(DB_NAME)"-wal", TO_STRING(DB_NAME)".corrupt-wal");
+    remove(TO_STRING(DB_NAME)"-shm");
+}
+
+
+/*
+ * Moves a batch that SQLite rejected out of the way, so it isn't retried forever
+ * \return zero for success, and non-zero if the quarantine file can't be written
+ */
+static int quarantine_rows(DBCONN *conn, sensor_data_t *rows, int count, int rc)
+{
+    printf("Batch of %d rows rejected (%s), moved to "TO_STRING(DB_QUARANTINE_FILE)".\n", count, sqlite3_errstr(rc));
+    logger_event(LOG_DB_QUARANTINED, 0, count, 0);
+    sensor_ts_t epoch;
+    FILE *fp = sensor_segment_append(TO_STRING(DB_QUARANTINE_FILE), &epoch);
+    int result = fp == NULL || sensor_segment_write(fp, rows, count, epoch) != 0;
+    if (fp != NULL && fclose(fp) != 0) result = 1;
+    if (result != 0)
+    {
+        fprintf(stderr, "Failed to write quarantine file "TO_STRING(DB_QUARANTINE_FILE)"\n");
+        return 1;
+    }
+    pthread_mutex_lock(&conn->stats_lock);
+    conn->stats.quarantined += count;
+    pthread_mutex_unlock(&conn->stats_lock);
+    return 0;
+}
+
+
+/*
+ * Appends the rows to the spool file, which stays open until it is replayed
+ */
+static int spool_rows(DBCONN *conn, sensor_data_t *rows, int count)
+{
+    if (conn->spool == NULL) conn->spool = sensor_segment_append(TO_STRING(DB_SPOOL_FILE), &conn->spool_epoch);
+    if (conn->spool == NULL || sensor_segment_write(conn->spool, rows, count, conn->spool_epoch) != 0 || fflush(conn->spool) != 0)
+    {
+        fprintf(stderr, "Failed to write spool file "TO_STRING(DB_SPOOL_FILE)"\n");
         return 1;
-    } 
-    sqlite3_close(conn);
+    }
+    pthread_mutex_lock(&conn->stats_lock);
+    conn->stats.spooled += count;
+    pthread_mutex_unlock(&conn->stats_lock);
     return 0;
 }
 
 
+static void schedule_reconnect(DBCONN *conn)
+{
+    conn->next_reconnect = time(NULL) + conn->reconnect_delay;
+    conn->reconnect_delay *= 2;
+    if (conn->reconnect_delay > DB_RECONNECT_MAX) conn->reconnect_delay = DB_RECONNECT_MAX;
+}
+
+
+/*
+ * Tries to open the database again once the backoff delay has passed and replays the spool
+ * \return zero when the database is open and the spool is empty, non-zero otherwise
+ */
+static int reconnect(DBCONN *conn)
+{
+    if (time(NULL) < conn->next_reconnect) return 1;
+    printf("Reconnecting to SQL server.\n");
+    logger_event(LOG_DB_RECONNECTING, 0, 0, 0);
+    if (open_database(conn) != 0)
+    {
+        pthread_mutex_lock(&conn->stats_lock);
+        conn->stats.reconnects++;
+        pthread_mutex_unlock(&conn->stats_lock);
+        schedule_reconnect(conn);
+        return 1;
+    }
+    conn->reconnect_delay = DB_RECONNECT_MIN;
+    return replay_spool(conn);
+}
+
+
+/*
+ * Inserts the spooled rows in batches of DB_BATCH_SIZE and truncates the spool
+ * If a batch fails, the rows that weren't committed yet are moved to the start of the spool file
+ * \return zero for success, and non-zero if an error occurs
+ */
+static int replay_spool(DBCONN *conn)
+{
+    if (conn->spool != NULL) fclose(conn->spool);
+    conn->spool = NULL;
+    sensor_ts_t epoch;
+    FILE *spool = sensor_segment_read(TO_STRING(DB_SPOOL_FILE), &epoch);
+    if (spool == NULL)
+    {
+        //keep a spool that can't be read out of the way of new spooling
+        if (access(TO_STRING(DB_SPOOL_FILE), F_OK) == 0) rename(TO_STRING(DB_SPOOL_FILE), TO_STRING(DB_SPOOL_FILE)".rejected");
+        return 0;
+    }
+
+    sensor_data_t *rows = malloc(DB_BATCH_SIZE*sizeof(sensor_data_t));
+    assert(rows != NULL);
+    unsigned long replayed = 0;
+    int count;
+    int result = 0;
+    while ((count = sensor_segment_read_rows(spool, rows, DB_BATCH_SIZE, epoch)) > 0)
+    {
+        int rc = commit_rows(conn, rows, count);
+        if (rc != SQLITE_OK && (is_connection_error(rc) || is_corrupt_error(rc)))
+        {
+            result = rc;
+            break;
+        }
+        if (rc != SQLITE_OK) quarantine_rows(conn, rows, count, rc);
+        else replayed += count;
+    }
+
+    if (result != 0)
+    {
+        //keep the rest: the failed batch and everything after it
+        sensor_ts_t rest_epoch;
+        remove(TO_STRING(DB_SPOOL_FILE)".tmp");
+        FILE *rest = sensor_segment_append(TO_STRING(DB_SPOOL_FILE)".tmp", &rest_epoch);
+        bool copied = rest != NULL && sensor_segment_write(rest, rows, count, rest_epoch) == 0;
+        while (copied && (count = sensor_segment_read_rows(spool, rows, DB_BATCH_SIZE, epoch)) > 0)
+        {
+            copied = sensor_segment_write(rest, rows, count, rest_epoch) == 0;
+        }
+        if (rest != NULL && fclose(rest) != 0) copied = false;
+        if (copied) rename(TO_STRING(DB_SPOOL_FILE)".tmp", TO_STRING(DB_SPOOL_FILE));
+        if (is_corrupt_error(result)) rotate_corrupt_database(conn);
+        else close_database(conn);
+        schedule_reconnect(conn);
+    } else
+    {
+        remove(TO_STRING(DB_SPOOL_FILE));
+    }
+    fclose(spool);
+    free(rows);
+
+    pthread_mutex_lock(&conn->stats_lock);
+    conn->stats.replayed += replayed;
+    pthread_mutex_unlock(&conn->stats_lock);
+    if (replayed > 0)
+    {
+        printf("Replayed %lu rows from "TO_STRING(DB_SPOOL_FILE)".\n", replayed);
+        logger_event(LOG_DB_REPLAYED, 0, replayed, 0);
+    }
+    return result;
+}
+
+
+/*
+ * Inserts one raw row and folds it into the rollup tables, runs inside the caller's transaction
+ */
+static int insert_row(DBCONN *conn, sensor_id_t id, sensor_value_t value, sensor_ts_t ts, time_t upload_time)
+{
+    sqlite3_bind_int(conn->insert_stmt, 1, id);
+    sqlite3_bind_double(conn->insert_stmt, 2, value);
+    sqlite3_bind_int64(conn->insert_stmt, 3, ts);
+    sqlite3_bind_int64(conn->insert_stmt, 4, upload_time);
+    int rc = sqlite3_step(conn->insert_stmt);
+    sqlite3_reset(conn->insert_stmt);
+    for (int i = 0; rc == SQLITE_DONE && i < ROLLUP_COUNT; i++)
+    {
+        sqlite3_bind_int(conn->rollup_stmts[i], 1, id);
+        sqlite3_bind_int64(conn->rollup_stmts[i], 2, ts - ts % rollup_seconds[i]);
+        sqlite3_bind_double(conn->rollup_stmts[i], 3, value);
+        rc = sqlite3_step(conn->rollup_stmts[i]);
+        sqlite3_reset(conn->rollup_stmts[i]);
+    }
+    return rc;
+}
+
+
+/*
+ * Deletes at most DB_PRUNE_CHUNK raw rows older than DB_RETENTION, one small chunk per committed batch keeps
+ * the writer from pausing on a big delete
+ */
+static void prune_sensor(DBCONN *conn)
+{
+    if (DB_RETENTION <= 0 || time(NULL) < conn->next_prune) return;
+    sqlite3_bind_int64(conn->prune_stmt, 1, time(NULL) - DB_RETENTION);
+    sqlite3_bind_int(conn->prune_stmt, 2, DB_PRUNE_CHUNK);
+    int rc = sqlite3_step(conn->prune_stmt);
+    sqlite3_reset(conn->prune_stmt);
+    if (rc != SQLITE_DONE) {
+        fprintf(stderr, "Failed to prune data: %s\n", sqlite3_errmsg(conn->db));
+        return;
+    }
+    //a partial chunk means everything is pruned for now
+    if (sqlite3_changes(conn->db) < DB_PRUNE_CHUNK) conn->next_prune = time(NULL) + DB_PRUNE_INTERVAL;
+}
+
+
+void get_storage_stats(DBCONN *conn, storage_stats_t *stats)
+{
+    pthread_mutex_lock(&conn->stats_lock);
+    *stats = conn->stats;
+    pthread_mutex_unlock(&conn->stats_lock);
+}
+
+
+static double elapsed_ms(struct timespec *since)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - since->tv_sec) * 1e3 + (now.tv_nsec - since->tv_nsec) / 1e6;
+}
+
+
+int find_sensor_all(DBCONN *conn, callback_t f)
+{
+    return execute_query(conn, get_query(conn, QUERY_ALL), f);
+}
+
+
 int find_sensor_by_value(DBCONN *conn, sensor_value_t value, callback_t f)
 {
-    char * sql = 0;
-    asprintf(&sql, "SELECT * FROM %s WHERE sensor_value = %f;", TO_STRING(TABLE_NAME),value);
-    return execute_query(conn, sql, f);
+    sqlite3_stmt *stmt = get_query(conn, QUERY_BY_VALUE);
+    if (stmt != NULL) sqlite3_bind_double(stmt, 1, value);
+    return execute_query(conn, stmt, f);
 }
 
 
 int find_sensor_exceed_value(DBCONN *conn, sensor_value_t value, callback_t f)
 {
-    char * sql = 0;
-    asprintf(&sql, "SELECT * FROM %s WHERE sensor_value > %f;", TO_STRING(TABLE_NAME),value);
-    return execute_query(conn, sql, f);
+    sqlite3_stmt *stmt = get_query(conn, QUERY_EXCEED_VALUE);
+    if (stmt != NULL) sqlite3_bind_double(stmt, 1, value);
+    return execute_query(conn, stmt, f);
 }
 
 
 int find_sensor_by_timestamp(DBCONN *conn, sensor_ts_t ts, callback_t f)
 {
-    char * sql = 0;
-    asprintf(&sql, "SELECT * FROM %s WHERE timestamp = %ld;", TO_STRING(TABLE_NAME),ts);
-    return execute_query(conn, sql, f);
+    sqlite3_stmt *stmt = get_query(conn, QUERY_BY_TIMESTAMP);
+    if (stmt != NULL) sqlite3_bind_int64(stmt, 1, ts);
+    return execute_query(conn, stmt, f);
 }
 
 
 int find_sensor_after_timestamp(DBCONN *conn, sensor_ts_t ts, callback_t f)
 {
-    char * sql = 0;
-    asprintf(&sql, "SELECT * FROM %s WHERE timestamp > %ld;", TO_STRING(TABLE_NAME),ts);
-    return execute_query(conn, sql, f);
+    sqlite3_stmt *stmt = get_query(conn, QUERY_AFTER_TIMESTAMP);
+    if (stmt != NULL) sqlite3_bind_int64(stmt, 1, ts);
+    return execute_query(conn, stmt, f);
 }
 
 
-int execute_query(DBCONN *conn, char * query, callback_t f)
+int find_sensor_by_id(DBCONN *conn, sensor_id_t id, callback_t f)
 {
-    char * err_msg = 0;
-    int rc = sqlite3_exec(conn, query, f, 0, &err_msg);
-    free(query);
-    if (rc != SQLITE_OK ) {
+    if (conn->tsdb != NULL) return query_tsdb(conn, id, INT64_MIN, INT64_MAX, f);
+    sqlite3_stmt *stmt = get_query(conn, QUERY_BY_ID);
+    if (stmt != NULL) sqlite3_bind_int(stmt, 1, id);
+    return execute_query(conn, stmt, f);
+}
+
+
+int find_sensor_time_range(DBCONN *conn, sensor_ts_t from, sensor_ts_t to, callback_t f)
+{
+    sqlite3_stmt *stmt = get_query(conn, QUERY_TIME_RANGE);
+    if (stmt != NULL)
+    {
+        sqlite3_bind_int64(stmt, 1, from);
+        sqlite3_bind_int64(stmt, 2, to);
+    }
+    return execute_query(conn, stmt, f);
+}
+
+
+int find_sensor_id_time_range(DBCONN *conn, sensor_id_t id, sensor_ts_t from, sensor_ts_t to, callback_t f)
+{
+    if (conn->tsdb != NULL) return query_tsdb(conn, id, from, to, f);
+    sqlite3_stmt *stmt = get_query(conn, QUERY_ID_TIME_RANGE);
+    if (stmt != NULL)
+    {
+        sqlite3_bind_int(stmt, 1, id);
+        sqlite3_bind_int64(stmt, 2, from);
+        sqlite3_bind_int64(stmt, 3, to);
+    }
+    return execute_query(conn, stmt, f);
+}
+
+
+int find_sensor_value_range(DBCONN *conn, sensor_value_t min, sensor_value_t max, callback_t f)
+{
+    sqlite3_stmt *stmt = get_query(conn, QUERY_VALUE_RANGE);
+    if (stmt != NULL)
+    {
+        sqlite3_bind_double(stmt, 1, min);
+        sqlite3_bind_double(stmt, 2, max);
+    }
+    return execute_query(conn, stmt, f);
+}
+
+
+int find_sensor_rollup(DBCONN *conn, rollup_t resolution, sensor_id_t id, sensor_ts_t from, sensor_ts_t to, callback_t f)
+{
+    sqlite3_stmt *stmt = get_query(conn, resolution == ROLLUP_HOUR ? QUERY_ROLLUP_HOUR : QUERY_ROLLUP_MINUTE);
+    if (stmt != NULL)
+    {
+        sqlite3_bind_int(stmt, 1, id);
+        sqlite3_bind_int64(stmt, 2, from);
+        sqlite3_bind_int64(stmt, 3, to);
+    }
+    return execute_query(conn, stmt, f);
+}
+
+
+/*
+ * Hands the readings of a TSDB query to 'f' as text columns, like execute_query() does
+ */
+typedef struct {
+    callback_t f;
+} tsdb_query_arg_t;
+
+static int tsdb_row(const sensor_data_t *data, void *arg)
+{
+    char id[8], value[32], ts[24];
+    char *values[] = {id, value, ts};
+    char *names[] = {"sensor_id", "sensor_value", "sensor_time"};
+    snprintf(id, sizeof(id), "%u", data->id);
+    snprintf(value, sizeof(value), "%g", data->value);
+    snprintf(ts, sizeof(ts), "%" PRId64, (int64_t)data->ts);
+    return ((tsdb_query_arg_t *)arg)->f(0, 3, values, names);
+}
+
+static int query_tsdb(DBCONN *conn, sensor_id_t id, sensor_ts_t from, sensor_ts_t to, callback_t f)
+{
+    if (f == NULL) return 0;
+    tsdb_query_arg_t arg = {.f = f};
+    return tsdb_query(conn->tsdb, id, from, to, tsdb_row, &arg);
+}
+
+
+static sqlite3_stmt *get_query(DBCONN *conn, query_t query)
+{
+    if (conn->tsdb != NULL)
+    {
+        fprintf(stderr, "Query not supported by the "TO_STRING(TSDB_DIR)" store\n");
+        return NULL;
+    }
+    if (conn->db == NULL)
+    {
+        fprintf(stderr, "Not connected to SQL server\n");
+        return NULL;
+    }
+    if (conn->queries[query] == NULL)
+    {
+        int rc = sqlite3_prepare_v2(conn->db, query_sql[query], -1, &conn->queries[query], 0);
+        if (rc != SQLITE_OK) {
+            fprintf(stderr, "Failed to prepare query: %s\n", sqlite3_errmsg(conn->db));
+            conn->queries[query] = NULL;
+        }
+    }
+    return conn->queries[query];
+}
+
+
+/*
+ * Steps through the result set and hands every row to 'f' the way sqlite3_exec() does,
+ * the statement is reset afterwards so it can be reused
+ */
+static int execute_query(DBCONN *conn, sqlite3_stmt *stmt, callback_t f)
+{
+    if (stmt == NULL) return 1;
+    int columns = sqlite3_column_count(stmt);
+    char *values[columns];
+    char *names[columns];
+    for (int i = 0; i < columns; i++) names[i] = (char *)sqlite3_column_name(stmt, i);
+
+    int rc;
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW)
+    {
+        if (f == NULL) continue;
+        for (int i = 0; i < columns; i++) values[i] = (char *)sqlite3_column_text(stmt, i);
+        if (f(0, columns, values, names) != 0)
+        {
+            rc = SQLITE_ABORT;
+            break;
+        }
+    }
+    sqlite3_reset(stmt);
+    sqlite3_clear_bindings(stmt);
+    if (rc != SQLITE_DONE) {
         fprintf(stderr, "Failed to select data\n");
-        fprintf(stderr, "SQL error: %s\n", err_msg);
-        sqlite3_free(err_msg);
-        sqlite3_close(conn);
+        fprintf(stderr, "SQL error: %s\n", rc == SQLITE_ABORT ? "query aborted" : sqlite3_errmsg(conn->db));
         return 1;
-    } 
-    sqlite3_close(conn);
+    }
     return 0;
 }
+
+
+sensor_db_query_t *sensor_db_query_open(DBCONN *conn, const sensor_db_filter_t *filter, int batch_size)
+{
+    const char *sql = filter->sensor_id < 0
+        ? "SELECT sensor_id, sensor_value, sensor_time FROM "TO_STRING(TABLE_NAME)
+          " WHERE sensor_time BETWEEN ?2 AND ?3 AND sensor_value BETWEEN ?4 AND ?5 ORDER BY sensor_time;"
+        : "SELECT sensor_id, sensor_value, sensor_time FROM "TO_STRING(TABLE_NAME)
+          " WHERE sensor_id = ?1 AND sensor_time BETWEEN ?2 AND ?3 AND sensor_value BETWEEN ?4 AND ?5 ORDER BY sensor_time;";
+    if (batch_size <= 0 || conn->db == NULL) return NULL;
+    sensor_db_query_t *query = malloc(sizeof(sensor_db_query_t) + batch_size*sizeof(sensor_data_t));
+    assert(query != NULL);
+    query->conn = conn;
+    query->batch_size = batch_size;
+    query->done = false;
+    int rc = sqlite3_prepare_v2(conn->db, sql, -1, &query->stmt, 0);
+    if (rc != SQLITE_OK) {
+        fprintf(stderr, "Failed to prepare query: %s\n", sqlite3_errmsg(conn->db));
+        free(query);
+        return NULL;
+    }
+    if (filter->sensor_id >= 0) sqlite3_bind_int(query->stmt, 1, filter->sensor_id);
+    sqlite3_bind_int64(query->stmt, 2, filter->from);
+    sqlite3_bind_int64(query->stmt, 3, filter->to);
+    sqlite3_bind_double(query->stmt, 4, filter->min);
+    sqlite3_bind_double(query->stmt, 5, filter->max);
+    return query;
+}
+
+
+int sensor_db_query_next(sensor_db_query_t *query, sensor_data_t **rows)
+{
+    int count = 0;
+    *rows = query->rows;
+    while (!query->done && count < query->batch_size)
+    {
+        int rc = sqlite3_step(query->stmt);
+        if (rc == SQLITE_DONE)
+        {
+            query->done = true;
+        } else if (rc == SQLITE_ROW)
+        {
+            query->rows[count].id = sqlite3_column_int(query->stmt, 0);
+            query->rows[count].value = sqlite3_column_double(query->stmt, 1);
+            query->rows[count].ts = sqlite3_column_int64(query->stmt, 2);
+            count++;
+        } else
+        {
+            fprintf(stderr, "Failed to select data: %s\n", sqlite3_errmsg(query->conn->db));
+            query->done = true;
+            return -1;
+        }
+    }
+    return count;
+}
+
+
+void sensor_db_query_close(sensor_db_query_t **query)
+{
+    if (*query == NULL) return;
+    sqlite3_finalize((*query)->stmt);
+    free(*query);
+    *query = NULL;
+}
+
+
+sensor_db_pool_t *sensor_db_pool_create(int size)
+{
+    //a TSDB connection isn't safe to share between threads and has nothing to open read-only
+    if (STORAGE_BACKEND == STORAGE_TSDB)
+    {
+        fprintf(stderr, "Cannot create a connection pool on the time-series store\n");
+        return NULL;
+    }
+    if (size <= 0) size = DB_POOL_SIZE;
+    sensor_db_pool_t *pool = calloc(1, sizeof(sensor_db_pool_t));
+    assert(pool != NULL);
+    pool->free = malloc(size*sizeof(DBCONN *));
+    assert(pool->free != NULL);
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->cond, NULL);
+    pool->size = size;
+
+    for (int i = 0; i < size; i++)
+    {
+        DBCONN *conn = calloc(1, sizeof(DBCONN));
+        assert(conn != NULL);
+        conn->read_only = true;
+        pthread_mutex_init(&conn->stats_lock, NULL);
+        pool->free[pool->available++] = conn;
+
+        int rc = sqlite3_open_v2(TO_STRING(DB_NAME), &conn->db, SQLITE_OPEN_READONLY, NULL);
+        //the writer checkpoints the WAL now and then, a reader waits for that instead of failing
+        if (rc == SQLITE_OK) rc = sqlite3_busy_timeout(conn->db, DB_POOL_WAIT_MS);
+        if (rc != SQLITE_OK)
+        {
+            //a read-only open doesn't create the file, init_connection() must have done that
+            if (rc == SQLITE_CANTOPEN) fprintf(stderr, "Cannot open database "TO_STRING(DB_NAME)", it doesn't exist yet\n");
+            else fprintf(stderr, "Cannot open database: %s\n", sqlite3_errmsg(conn->db));
+            pool->size = pool->available;
+            sensor_db_pool_free(&pool);
+            return NULL;
+        }
+    }
+    return pool;
+}
+
+
+DBCONN *sensor_db_pool_borrow(sensor_db_pool_t *pool)
+{
+    pthread_mutex_lock(&pool->lock);
+    double wait_ms = 0;
+    if (pool->available == 0)
+    {
+        struct timespec start, deadline;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += DB_POOL_WAIT_MS / 1000;
+        deadline.tv_nsec += (DB_POOL_WAIT_MS % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L)
+        {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        int rc = 0;
+        while (pool->available == 0 && rc == 0) rc = pthread_cond_timedwait(&pool->cond, &pool->lock, &deadline);
+        wait_ms = elapsed_ms(&start);
+        pool->stats.waits++;
+        pool->stats.total_wait_ms += wait_ms;
+        if (wait_ms > pool->stats.max_wait_ms) pool->stats.max_wait_ms = wait_ms;
+    }
+    DBCONN *conn = NULL;
+    if (pool->available > 0)
+    {
+        conn = pool->free[--pool->available];
+        pool->stats.borrows++;
+    } else
+    {
+        pool->stats.timeouts++;
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return conn;
+}
+
+
+void sensor_db_pool_release(sensor_db_pool_t *pool, DBCONN *conn)
+{
+    pthread_mutex_lock(&pool->lock);
+    assert(pool->available < pool->size);
+    pool->free[pool->available++] = conn;
+    pthread_cond_signal(&pool->cond);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+
+void sensor_db_pool_get_stats(sensor_db_pool_t *pool, sensor_db_pool_stats_t *stats)
+{
+    pthread_mutex_lock(&pool->lock);
+    *stats = pool->stats;
+    pthread_mutex_unlock(&pool->lock);
+}
+
+
+void sensor_db_pool_free(sensor_db_pool_t **pool)
+{
+    assert((*pool)->available == (*pool)->size);
+    for (int i = 0; i < (*pool)->available; i++) disconnect((*pool)->free[i]);
+    pthread_cond_destroy(&(*pool)->cond);
+    pthread_mutex_destroy(&(*pool)->lock);
+    free((*pool)->free);
+    free(*pool);
+    *pool = NULL;
+}
+
+
+FILE *sensor_segment_append(const char *path, sensor_ts_t *epoch)
+{
+    FILE *fp = fopen(path, "a+b");
+    if (fp == NULL) return NULL;
+    sensor_segment_t header;
+    fseek(fp, 0, SEEK_END);
+    if (ftell(fp) == 0)
+    {
+        header.magic = SENSOR_SEGMENT_MAGIC;
+        header.record_size = sizeof(sensor_record_t);
+        header.epoch = time(NULL);
+        if (fwrite(&header, sizeof(header), 1, fp) != 1)
+        {
+            fclose(fp);
+            return NULL;
+        }
+    } else
+    {
+        rewind(fp);
+        if (fread(&header, sizeof(header), 1, fp) != 1 || header.magic != SENSOR_SEGMENT_MAGIC
+            || header.record_size != sizeof(sensor_record_t))
+        {
+            fprintf(stderr, "%s is not a segment of this record format\n", path);
+            fclose(fp);
+            return NULL;
+        }
+    }
+    *epoch = header.epoch;
+    return fp;
+}
+
+
+FILE *sensor_segment_read(const char *path, sensor_ts_t *epoch)
+{
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL) return NULL;
+    sensor_segment_t header;
+    if (fread(&header, sizeof(header), 1, fp) != 1 || header.magic != SENSOR_SEGMENT_MAGIC
+        || header.record_size != sizeof(sensor_record_t))
+    {
+        fprintf(stderr, "%s is not a segment of this record format\n", path);
+        fclose(fp);
+        return NULL;
+    }
+    *epoch = header.epoch;
+    return fp;
+}
+
+
+#define SEGMENT_CHUNK 256
+
+int sensor_segment_write(FILE *fp, const sensor_data_t *rows, int count, sensor_ts_t epoch)
+{
+    sensor_record_t records[SEGMENT_CHUNK];
+    for (int done = 0; done < count; )
+    {
+        int n = count - done < SEGMENT_CHUNK ? count - done : SEGMENT_CHUNK;
+        for (int i = 0; i < n; i++) sensor_record_pack(&records[i], &rows[done + i], epoch);
+        if (fwrite(records, sizeof(sensor_record_t), n, fp) != n) return 1;
+        done += n;
+    }
+    return 0;
+}
+
+
+int sensor_segment_read_rows(FILE *fp, sensor_data_t *rows, int max, sensor_ts_t epoch)
+{
+    sensor_record_t records[SEGMENT_CHUNK];
+    int count = 0;
+    while (count < max)
+    {
+        int want = max - count < SEGMENT_CHUNK ? max - count : SEGMENT_CHUNK;
+        int n = fread(records, sizeof(sensor_record_t), want, fp);
+        for (int i = 0; i < n; i++) sensor_record_unpack(&rows[count + i], &records[i], epoch);
+        count += n;
+        if (n < want) break;
+    }
+    return count;
+}
@@ -9,29 +9,155 @@
 #include <stdlib.h>
 #include "config.h"
 #include <sqlite3.h>
+#include <float.h>
 #include "sbuffer.h"
 
 
-// stringify preprocessor directives using 2-level preprocessor magic
-// this avoids using directives like -DDB_NAME=\"some_db_name\"
-#define REAL_TO_STRING(s) #s
-#define TO_STRING(s) REAL_TO_STRING(s)    //force macro-expansion on s before stringify s
+/*
+ * Inserts are grouped in transactions of at most DB_BATCH_SIZE rows, a transaction is committed at the latest
+ * DB_BATCH_MS milliseconds after its first row
+ */
+#ifndef DB_BATCH_SIZE
+#define DB_BATCH_SIZE 1000
+#endif
+
+#ifndef DB_BATCH_MS
+#define DB_BATCH_MS 100
+#endif
+
+/*
+ * Value for PRAGMA synchronous (OFF, NORMAL, FULL), the database runs in WAL journal mode
+ */
+#ifndef DB_SYNCHRONOUS
+#define DB_SYNCHRONOUS NORMAL
+#endif
+
+/*
+ * Raw rows older than DB_RETENTION sec are deleted in chunks of DB_PRUNE_CHUNK rows after each committed batch,
+ * 0 keeps them forever. Once nothing is left to prune, the next prune waits DB_PRUNE_INTERVAL sec.
+ * The 1 minute and 1 hour rollup tables are kept.
+ */
+#ifndef DB_RETENTION
+#define DB_RETENTION (30*24*3600)
+#endif
+
+#ifndef DB_PRUNE_CHUNK
+#define DB_PRUNE_CHUNK 500
+#endif
 
-#ifndef DB_NAME
-#define DB_NAME Sensor.db
+#ifndef DB_PRUNE_INTERVAL
+#define DB_PRUNE_INTERVAL 60
 #endif
 
-#ifndef TABLE_NAME
-#define TABLE_NAME SensorData
+/*
+ * While the database can't be opened or a batch fails to commit because of the connection or the disk (busy, locked,
+ * I/O error, can't open, disk full), batches are appended to the binary spool file DB_SPOOL_FILE. Reconnecting is
+ * tried before every batch, but no sooner than DB_RECONNECT_MIN sec after a failed attempt, doubling up to
+ * DB_RECONNECT_MAX sec. Once connected again the spool is replayed in batches of DB_BATCH_SIZE rows and truncated.
+ * A corrupt database (or a file that isn't one) never recovers by retrying: DB_NAME is renamed to DB_NAME.corrupt,
+ * together with its WAL, the batch is spooled and the reconnect starts a fresh database.
+ * A batch that fails for any other reason (constraint, a row SQLite rejects) would fail again on every replay, it is
+ * appended to the segment file DB_QUARANTINE_FILE instead and the connection is kept.
+ * The file names are defined in config.h.
+ */
+
+#ifndef DB_RECONNECT_MIN
+#define DB_RECONNECT_MIN 1
 #endif
 
-#define DBCONN sqlite3
+#ifndef DB_RECONNECT_MAX
+#define DB_RECONNECT_MAX 60
+#endif
+
+/*
+ * Read-only connections for queries next to the storagemgr writer, a borrower waits at most DB_POOL_WAIT_MS ms
+ * for a free connection. In WAL mode readers and the writer don't block each other.
+ */
+#ifndef DB_POOL_SIZE
+#define DB_POOL_SIZE 4
+#endif
+
+#ifndef DB_POOL_WAIT_MS
+#define DB_POOL_WAIT_MS 1000
+#endif
+
+/*
+ * Storage engine behind a connection: STORAGE_SQLITE, or STORAGE_TSDB for the append-only column files of sensor_tsdb.h
+ * With STORAGE_TSDB only find_sensor_by_id() and find_sensor_id_time_range() are supported, there are no rollups
+ * and no retention
+ */
+#define STORAGE_SQLITE 0
+#define STORAGE_TSDB 1
+
+#ifndef STORAGE_BACKEND
+#define STORAGE_BACKEND STORAGE_SQLITE
+#endif
+
+/*
+ * Resolution of the rollup tables, every rollup row holds min, max, mean and count of one sensor over one bucket
+ */
+typedef enum {
+    ROLLUP_MINUTE, ROLLUP_HOUR, ROLLUP_COUNT
+} rollup_t;
+
+typedef struct dbconn dbconn_t;
+
+/*
+ * Metrics of the storagemgr writer, times in ms
+ * A connection only keeps the batch and spool metrics, the swap waits are counted by storage_sink_consume()
+ */
+typedef struct {
+    unsigned long batches;          /**< number of committed batches */
+    unsigned long rows;             /**< number of committed rows */
+    int last_batch_size;
+    double last_commit_ms;
+    double max_commit_ms;
+    double total_commit_ms;
+    unsigned long swap_waits;       /**< number of times the consumer had to wait for the writer to finish a batch */
+    double swap_wait_ms;            /**< total time the consumer waited for the writer */
+    unsigned long spooled;          /**< number of rows appended to the spool file */
+    unsigned long replayed;         /**< number of spooled rows inserted after a reconnect */
+    unsigned long reconnects;       /**< number of failed reconnect attempts */
+    unsigned long quarantined;      /**< number of rows moved to the quarantine file */
+} storage_stats_t;
+
+#define DBCONN dbconn_t
 
 typedef int (*callback_t)(void *, int, char **, char **);
 
+/*
+ * Selection for a streaming query, all bounds are inclusive
+ */
+typedef struct {
+    int sensor_id;                  /**< -1 selects every sensor */
+    sensor_ts_t from;
+    sensor_ts_t to;
+    sensor_value_t min;
+    sensor_value_t max;
+} sensor_db_filter_t;
+
+#define SENSOR_DB_FILTER_ALL {-1, 0, INT64_MAX, -DBL_MAX, DBL_MAX}
+
+typedef struct sensor_db_query sensor_db_query_t;
+
+typedef struct sensor_db_pool sensor_db_pool_t;
+
+/*
+ * Metrics of a connection pool, times in ms
+ */
+typedef struct {
+    unsigned long borrows;          /**< number of connections handed out */
+    unsigned long waits;            /**< number of borrows that had to wait for a free connection */
+    unsigned long timeouts;         /**< number of borrows that gave up after DB_POOL_WAIT_MS */
+    double total_wait_ms;
+    double max_wait_ms;
+} sensor_db_pool_stats_t;
+
 /**
  * Make a connection to the database server
  * Create (open) a database with name DB_NAME having 1 table named TABLE_NAME  
+ * If the database can't be opened the connection is still returned, inserts are spooled until a reconnect succeeds
+ * A spool left behind by an earlier run is replayed once the database is open
  * \param clear_up_flag if the table existed, clear up the existing data when clear_up_flag is set to 1
  * \return the connection for success, NULL if an error occurs
  */
@@ -45,6 +171,8 @@ void disconnect(DBCONN *conn);
 
 /**
  * Write an INSERT query to insert a single sensor measurement
+ * The row is added to the pending batch, the batch is committed once it holds DB_BATCH_SIZE rows
+ * or is older than DB_BATCH_MS
  * \param conn pointer to the current connection
  * \param id the sensor id
  * \param value the measurement value
@@ -54,12 +182,34 @@ void disconnect(DBCONN *conn);
 int insert_sensor(DBCONN *conn, sensor_id_t id, sensor_value_t value, sensor_ts_t ts);
 
 /**
- * Write an INSERT query to insert all sensor measurements available in the file 'sensor_data'
+ * Commits the pending batch of insert_sensor(), if any
+ * \param conn pointer to the current connection
+ * \return zero for success, and non-zero if an error occurs
+ */
+int flush_sensor(DBCONN *conn);
+
+/**
+ * Inserts 'count' sensor measurements in one transaction, the pending batch of insert_sensor() is committed first
+ * A batch that can't be committed because of the connection is spooled, that only counts as an error when the
+ * spool can't be written either. A batch that SQLite rejects is quarantined and counts as an error.
  * \param conn pointer to the current connection
- * \param sensor_data a file pointer to binary file containing sensor data
+ * \param rows the sensor measurements
+ * \param count the number of sensor measurements in 'rows'
  * \return zero for success, and non-zero if an error occurs
  */
-int insert_sensor_from_buffer(DBCONN *conn, sbuffer_t *sbuffer, int storagemgr_id);
+int insert_sensor_batch(DBCONN *conn, sensor_data_t *rows, int count);
+
+/**
+ * Copies the metrics of the batches inserted on 'conn', safe to call from any thread
+ * \param conn pointer to the current connection
+ * \param stats will be filled out with the metrics
+ */
+void get_storage_stats(DBCONN *conn, storage_stats_t *stats);
+
+/*
+ * Queries run on prepared statements that are cached in the connection, the connection stays open
+ * A connection must not be queried from 2 threads at the same time, concurrent readers borrow from a sensor_db_pool_t
+ */
 
 /**
   * Write a SELECT query to select all sensor measurements in the table 
@@ -110,4 +260,164 @@ int find_sensor_by_timestamp(DBCONN *conn, sensor_ts_t ts, callback_t f);
  */
 int find_sensor_after_timestamp(DBCONN *conn, sensor_ts_t ts, callback_t f);
 
+/**
+ * Write a SELECT query to return all sensor measurements of sensor 'id', ordered on timestamp
+ * The callback function is applied to every row in the result
+ * \param conn pointer to the current connection
+ * \param id the sensor id to be queried
+ * \param f function pointer to the callback method that will handle the result set
+ * \return zero for success, and non-zero if an error occurs
+ */
+int find_sensor_by_id(DBCONN *conn, sensor_id_t id, callback_t f);
+
+/**
+ * Write a SELECT query to return all sensor measurements recorded between 'from' and 'to' (inclusive), ordered on timestamp
+ * The callback function is applied to every row in the result
+ * \param conn pointer to the current connection
+ * \param from the start of the time range
+ * \param to the end of the time range
+ * \param f function pointer to the callback method that will handle the result set
+ * \return zero for success, and non-zero if an error occurs
+ */
+int find_sensor_time_range(DBCONN *conn, sensor_ts_t from, sensor_ts_t to, callback_t f);
+
+/**
+ * Write a SELECT query to return all sensor measurements of sensor 'id' recorded between 'from' and 'to' (inclusive),
+ * ordered on timestamp
+ * The callback function is applied to every row in the result
+ * \param conn pointer to the current connection
+ * \param id the sensor id to be queried
+ * \param from the start of the time range
+ * \param to the end of the time range
+ * \param f function pointer to the callback method that will handle the result set
+ * \return zero for success, and non-zero if an error occurs
+ */
+int find_sensor_id_time_range(DBCONN *conn, sensor_id_t id, sensor_ts_t from, sensor_ts_t to, callback_t f);
+
+/**
+ * Write a SELECT query to return all sensor measurements with a temperature between 'min' and 'max' (inclusive)
+ * The callback function is applied to every row in the result
+ * \param conn pointer to the current connection
+ * \param min the lower bound of the value range
+ * \param max the upper bound of the value range
+ * \param f function pointer to the callback method that will handle the result set
+ * \return zero for success, and non-zero if an error occurs
+ */
+int find_sensor_value_range(DBCONN *conn, sensor_value_t min, sensor_value_t max, callback_t f);
+
+/**
+ * Write a SELECT query on a rollup table to return the aggregates of sensor 'id' for the buckets between 'from' and 'to'
+ * The callback function is applied to every row in the result, the columns are
+ * sensor_id, bucket, value_min, value_max, value_mean and value_count
+ * \param conn pointer to the current connection
+ * \param resolution ROLLUP_MINUTE or ROLLUP_HOUR
+ * \param id the sensor id to be queried
+ * \param from the start of the time range
+ * \param to the end of the time range
+ * \param f function pointer to the callback method that will handle the result set
+ * \return zero for success, and non-zero if an error occurs
+ */
+int find_sensor_rollup(DBCONN *conn, rollup_t resolution, sensor_id_t id, sensor_ts_t from, sensor_ts_t to, callback_t f);
+
+/**
+ * Opens a streaming query that yields the selected sensor measurements as sensor_data_t records, ordered on timestamp
+ * The records are read straight from the columns, without the text round trip of the find_* callbacks
+ * Several queries can be open on the same connection at the same time
+ * \param conn pointer to the current connection
+ * \param filter the measurements to select
+ * \param batch_size max number of records sensor_db_query_next() returns at once, bounds the memory the query uses
+ * \return the query, NULL if an error occurs
+ */
+sensor_db_query_t *sensor_db_query_open(DBCONN *conn, const sensor_db_filter_t *filter, int batch_size);
+
+/**
+ * Fetches the next batch of records of an open query
+ * \param query the query
+ * \param rows will point to the records, they stay valid until the next call on 'query'
+ * \return the number of records in '*rows', 0 if the query is exhausted and -1 if an error occurs
+ */
+int sensor_db_query_next(sensor_db_query_t *query, sensor_data_t **rows);
+
+/**
+ * Closes a query and frees all its resources, '*query' is set to NULL
+ * \param query a double pointer to the query
+ */
+void sensor_db_query_close(sensor_db_query_t **query);
+
+/*
+ * A pool hands out read-only connections, a borrowed connection can be used with every find_* and
+ * sensor_db_query_* function while the storagemgr keeps inserting on its own connection
+ * Inserts on a read-only connection fail
+ */
+
+/**
+ * Opens 'size' read-only connections to DB_NAME, the database must exist already (see init_connection())
+ * A read-only open doesn't create DB_NAME, so this fails (SQLITE_CANTOPEN) when it is called before the first
+ * init_connection(). There is no pool for STORAGE_TSDB, this always fails with that backend.
+ * \param size the number of connections, DB_POOL_SIZE if 'size' is 0 or less
+ * \return the pool, NULL if an error occurs
+ */
+sensor_db_pool_t *sensor_db_pool_create(int size);
+
+/**
+ * Takes a connection from the pool, waits at most DB_POOL_WAIT_MS ms if all of them are borrowed
+ * \param pool the pool
+ * \return the connection, NULL if none became free in time
+ */
+DBCONN *sensor_db_pool_borrow(sensor_db_pool_t *pool);
+
+/**
+ * Gives a borrowed connection back to the pool
+ * \param pool the pool
+ * \param conn the connection returned by sensor_db_pool_borrow()
+ */
+void sensor_db_pool_release(sensor_db_pool_t *pool, DBCONN *conn);
+
+/**
+ * Copies the wait time metrics of the pool, safe to call from any thread
+ * \param pool the pool
+ * \param stats will be filled out with the metrics
+ */
+void sensor_db_pool_get_stats(sensor_db_pool_t *pool, sensor_db_pool_stats_t *stats);
+
+/**
+ * Closes every connection of the pool and frees all its resources, '*pool' is set to NULL
+ * All connections must have been released
+ * \param pool a double pointer to the pool
+ */
+void sensor_db_pool_free(sensor_db_pool_t **pool);
+
+/*
+ * Binary segment files (the spool, the "file" storage sink): a sensor_segment_t header followed by sensor_record_t
+ * records relative to the epoch in the header
+ */
+
+/**
+ * Opens a segment file for appending, a new or empty file gets a header with the current time as epoch
+ * \param path the file
+ * \param epoch will be set to the epoch of the segment
+ * \return the file, NULL if it can't be opened or holds another record format
+ */
+FILE *sensor_segment_append(const char *path, sensor_ts_t *epoch);
+
+/**
+ * Opens a segment file for reading, positioned at its first record
+ * \param path the file
+ * \param epoch will be set to the epoch of the segment
+ * \return the file, NULL if it can't be opened or holds another record format
+ */
+FILE *sensor_segment_read(const char *path, sensor_ts_t *epoch);
+
+/**
+ * Packs 'count' readings into records and writes them to the segment
+ * \return zero for success, and non-zero if an error occurs
+ */
+int sensor_segment_write(FILE *fp, const sensor_data_t *rows, int count, sensor_ts_t epoch);
+
+/**
+ * Reads at most 'max' records from the segment and unpacks them into 'rows'
+ * \return the number of readings in 'rows', 0 at the end of the segment
+ */
+int sensor_segment_read_rows(FILE *fp, sensor_data_t *rows, int max, sensor_ts_t epoch);
+
 #endif /* _SENSOR_DB_H_ */
\ No newline at end of file
@@ -0,0 +1,665 @@
+/**
+ * \author Koen Eelen
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include <math.h>
+#include <time.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "sensor_loadgen.h"
+
+typedef enum {
+    SIM_CLOSED, SIM_CONNECTING, SIM_CONNECTED
+} sim_state_t;
+
+/**
+ * A simulated sensor with its own connection to the gateway
+ */
+typedef struct {
+    sim_state_t state;
+    int sd;
+    sensor_id_t id;
+    sensor_value_t value;
+    size_t pending;                 /**< bytes in 'backlog' the socket didn't take yet */
+    size_t partial;                 /**< bytes of the first reading in 'backlog' that were sent already */
+    bool waiting;                   /**< registered for EPOLLOUT */
+    bool opened;                    /**< connected at least once, for the replay */
+    char backlog[LOADGEN_BACKLOG * SENSOR_RECORD_BYTES];
+} sim_sensor_t;
+
+typedef struct {
+    unsigned long sent;             /**< readings the kernel accepted completely */
+    unsigned long skipped;          /**< readings without a connected sensor or with a full backlog */
+    unsigned long errors;           /**< failed connects and sends, and queued readings lost with their connection */
+    unsigned long closed;           /**< connections closed by the gateway */
+    unsigned long reconnects;       /**< connects after a closed or failed connection */
+} loadgen_stats_t;
+
+/**
+ * A sensor waiting to connect again, see sim_retry()
+ */
+typedef struct {
+    int sensor;
+    int64_t at;
+} sim_retry_t;
+
+typedef struct {
+    int epfd;
+    sim_sensor_t *sensors;
+    int count;
+    int connected;
+    struct sockaddr_in server;
+    loadgen_stats_t stats;
+    sim_retry_t *retries;           /**< FIFO of closed sensors in order of 'at', NULL if they aren't reconnected */
+    int retry_head;
+    int retry_count;
+} sim_t;
+
+static volatile sig_atomic_t interrupted = 0;
+
+static void sim_flush(sim_t *sim, sim_sensor_t *sensor);
+
+static void on_interrupt(int signal)
+{
+    interrupted = 1;
+}
+
+static int64_t now_ns()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+void sensor_record_encode(char *buf, const sensor_data_t *data)
+{
+    memcpy(buf, &data->id, sizeof(data->id));
+    memcpy(buf + sizeof(data->id), &data->value, sizeof(data->value));
+    memcpy(buf + sizeof(data->id) + sizeof(data->value), &data->ts, sizeof(data->ts));
+}
+
+/*
+ * Closes the connection, the readings still in the backlog are lost and counted as errors
+ */
+static void sim_disconnect(sim_t *sim, sim_sensor_t *sensor)
+{
+    if (sensor->state == SIM_CONNECTED) sim->connected--;
+    epoll_ctl(sim->epfd, EPOLL_CTL_DEL, sensor->sd, NULL);
+    close(sensor->sd);
+    sensor->state = SIM_CLOSED;
+    sim->stats.errors += (sensor->partial + sensor->pending) / SENSOR_RECORD_BYTES;
+    sensor->pending = 0;
+    sensor->partial = 0;
+}
+
+/*
+ * Queues a closed sensor to connect again after LOADGEN_RECONNECT_MS, if the simulation reconnects sensors
+ * The delay is the same for every sensor, so appending keeps the FIFO in order of 'at'
+ */
+static void sim_retry(sim_t *sim, sim_sensor_t *sensor)
+{
+    if (sim->retries == NULL) return;
+    sim_retry_t *retry = &sim->retries[(sim->retry_head + sim->retry_count++) % sim->count];
+    retry->sensor = sensor - sim->sensors;
+    retry->at = now_ns() + LOADGEN_RECONNECT_MS * 1000000LL;
+}
+
+/*
+ * The connection failed or was closed by the gateway
+ */
+static void sim_lost(sim_t *sim, sim_sensor_t *sensor)
+{
+    sim_disconnect(sim, sensor);
+    sim_retry(sim, sensor);
+}
+
+static void sim_watch(sim_t *sim, sim_sensor_t *sensor, bool writable)
+{
+    struct epoll_event event;
+    event.events = EPOLLRDHUP | (writable ? EPOLLOUT : 0);
+    event.data.ptr = sensor;
+    epoll_ctl(sim->epfd, EPOLL_CTL_MOD, sensor->sd, &event);
+    sensor->waiting = writable;
+}
+
+/*
+ * Starts a non-blocking connect, the sensor is connected once its socket turns writable (see sim_poll())
+ * The plain socket API is used here: tcp_active_open() blocks until the gateway accepts, which stalls every other sensor
+ */
+static void sim_connect(sim_t *sim, sim_sensor_t *sensor)
+{
+    struct epoll_event event;
+    sensor->sd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (sensor->sd < 0)
+    {
+        sim->stats.errors++;
+        sim_retry(sim, sensor);
+        return;
+    }
+    if (connect(sensor->sd, (struct sockaddr *)&sim->server, sizeof(sim->server)) != 0 && errno != EINPROGRESS)
+    {
+        close(sensor->sd);
+        sim->stats.errors++;
+        sim_retry(sim, sensor);
+        return;
+    }
+    event.events = EPOLLRDHUP | EPOLLOUT;
+    event.data.ptr = sensor;
+    epoll_ctl(sim->epfd, EPOLL_CTL_ADD, sensor->sd, &event);
+    sensor->state = SIM_CONNECTING;
+    sensor->pending = 0;
+    sensor->partial = 0;
+    sensor->waiting = true;
+}
+
+static void sim_connected(sim_t *sim, sim_sensor_t *sensor)
+{
+    int error = 0;
+    socklen_t length = sizeof(error);
+    if (getsockopt(sensor->sd, SOL_SOCKET, SO_ERROR, &error, &length) != 0 || error != 0)
+    {
+        sim->stats.errors++;
+        sim_lost(sim, sensor);
+        return;
+    }
+    sensor->state = SIM_CONNECTED;
+    sim->connected++;
+    if (sensor->pending > 0)
+    {
+        sim_flush(sim, sensor);
+    } else
+    {
+        sim_watch(sim, sensor, false);
+    }
+}
+
+/*
+ * Sends as much of the backlog as the socket takes, and only waits for EPOLLOUT while something is left
+ * A reading only counts as sent once all of its bytes were accepted
+ */
+static void sim_flush(sim_t *sim, sim_sensor_t *sensor)
+{
+    ssize_t sent = send(sensor->sd, sensor->backlog, sensor->pending, MSG_NOSIGNAL);
+    if (sent < 0)
+    {
+        if (errno != EAGAIN && errno != EINTR)
+        {
+            sim->stats.errors++;
+            sim_lost(sim, sensor);
+            return;
+        }
+        sent = 0;
+    }
+    sim->stats.sent += (sensor->partial + sent) / SENSOR_RECORD_BYTES;
+    sensor->partial = (sensor->partial + sent) % SENSOR_RECORD_BYTES;
+    memmove(sensor->backlog, sensor->backlog + sent, sensor->pending - sent);
+    sensor->pending -= sent;
+    if ((sensor->pending > 0) != sensor->waiting) sim_watch(sim, sensor, sensor->pending > 0);
+}
+
+static bool sim_backlog_full(sim_sensor_t *sensor)
+{
+    return sensor->pending + SENSOR_RECORD_BYTES > sizeof(sensor->backlog);
+}
+
+/*
+ * Queues a reading on 'sensor', it is sent right away if the sensor is connected and its socket isn't full
+ */
+static void sim_queue(sim_t *sim, sim_sensor_t *sensor, const sensor_data_t *data)
+{
+    if (sensor->state == SIM_CLOSED || sim_backlog_full(sensor))
+    {
+        sim->stats.skipped++;
+        return;
+    }
+    sensor_record_encode(sensor->backlog + sensor->pending, data);
+    bool idle = sensor->pending == 0;
+    sensor->pending += SENSOR_RECORD_BYTES;
+    if (idle && sensor->state == SIM_CONNECTED) sim_flush(sim, sensor);
+}
+
+/*
+ * Queues the next simulated reading of 'sensor'
+ */
+static void sim_send(sim_t *sim, sim_sensor_t *sensor, sensor_ts_t ts)
+{
+    sensor_data_t data;
+    sensor->value = sensor->value + TEMP_DEV * ((drand48() - 0.5) / 10);
+    data.id = sensor->id;
+    data.value = sensor->value;
+    data.ts = ts;
+    sim_queue(sim, sensor, &data);
+}
+
+static void sim_poll(sim_t *sim, int timeout_ms)
+{
+    struct epoll_event events[64];
+    int ready = epoll_wait(sim->epfd, events, 64, timeout_ms);
+    for (int i = 0; i < ready; i++)
+    {
+        sim_sensor_t *sensor = events[i].data.ptr;
+        if (sensor->state == SIM_CLOSED) continue;
+        if (sensor->state == SIM_CONNECTING)
+        {
+            sim_connected(sim, sensor);
+        } else if (events[i].events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+        {
+            sim->stats.closed++;
+            sim_lost(sim, sensor);
+        } else if (events[i].events & EPOLLOUT)
+        {
+            sim_flush(sim, sensor);
+        }
+    }
+}
+
+/*
+ * Reads the sensor ids of a room_sensor.map file
+ */
+static int load_sensor_ids(const char *path, sensor_id_t *ids, int max)
+{
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) return 0;
+    int count = 0;
+    room_id_t room;
+    sensor_id_t id;
+    while (count < max && fscanf(fp, "%" SCNu16 " %" SCNu16, &room, &id) == 2) ids[count++] = id;
+    fclose(fp);
+    return count;
+}
+
+/*
+ * One connection per simulated sensor, so the open file limit is raised as far as allowed
+ */
+static void raise_file_limit(int sensors)
+{
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) != 0 || limit.rlim_cur >= (rlim_t)sensors + 16) return;
+    limit.rlim_cur = limit.rlim_max == RLIM_INFINITY || limit.rlim_max > (rlim_t)sensors + 16 ? (rlim_t)sensors + 16 : limit.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &limit);
+}
+
+static void print_report(sim_t *sim, double elapsed, unsigned long interval_sent, double interval, double rate)
+{
+    printf("%.1f s: %d connected, %lu sent (%.0f/s now, %.0f/s avg, target %.0f/s), %lu skipped, %lu errors, %lu closed by gateway, %lu reconnects\n",
+           elapsed, sim->connected, sim->stats.sent, interval_sent / interval, sim->stats.sent / elapsed, rate,
+           sim->stats.skipped, sim->stats.errors, sim->stats.closed, sim->stats.reconnects);
+    fflush(stdout);
+}
+
+static void print_usage()
+{
+    printf("Use the load generator with these options: sensor_node -L [options] server_ip server_port\n");
+    printf("\t%-15s : number of simulated sensors (default 100)\n", "-n sensors");
+    printf("\t%-15s : aggregate readings per second (default 1000)\n", "-r rate");
+    printf("\t%-15s : Poisson arrivals instead of fixed inter-arrival times\n", "-P");
+    printf("\t%-15s : connects per second while ramping up (default 0: all at once)\n", "-c connects");
+    printf("\t%-15s : run time in seconds (default 0: until interrupted)\n", "-d seconds");
+    printf("\t%-15s : id of the first sensor, the others count up (default 1)\n", "-i id");
+    printf("\t%-15s : use the sensor ids of a room_sensor.map file, round-robin\n", "-m map file");
+}
+
+int loadgen_main(int argc, char *argv[])
+{
+    int count = 100;
+    double rate = 1000;
+    bool poisson = false;
+    double connect_rate = 0;
+    double duration = 0;
+    int first_id = 1;
+    char *map_file = NULL;
+    int option;
+
+    while ((option = getopt(argc, argv, "n:r:Pc:d:i:m:")) != -1)
+    {
+        switch (option)
+        {
+            case 'n': count = atoi(optarg); break;
+            case 'r': rate = atof(optarg); break;
+            case 'P': poisson = true; break;
+            case 'c': connect_rate = atof(optarg); break;
+            case 'd': duration = atof(optarg); break;
+            case 'i': first_id = atoi(optarg); break;
+            case 'm': map_file = optarg; break;
+            default:
+                print_usage();
+                return EXIT_FAILURE;
+        }
+    }
+    if (argc - optind != 2 || count <= 0 || rate <= 0)
+    {
+        print_usage();
+        return EXIT_FAILURE;
+    }
+
+    sim_t sim;
+    memset(&sim, 0, sizeof(sim));
+    sim.server.sin_family = AF_INET;
+    sim.server.sin_port = htons(atoi(argv[optind + 1]));
+    if (inet_aton(argv[optind], &sim.server.sin_addr) == 0)
+    {
+        printf("Error: invalid server IP %s.\n", argv[optind]);
+        return EXIT_FAILURE;
+    }
+    sim.count = count;
+    sim.sensors = calloc(count, sizeof(sim_sensor_t));
+    sim.retries = malloc(count * sizeof(sim_retry_t));
+    sim.epfd = epoll_create1(0);
+    if (sim.sensors == NULL || sim.retries == NULL || sim.epfd < 0)
+    {
+        printf("Error: can't allocate %d sensors.\n", count);
+        return EXIT_FAILURE;
+    }
+
+    sensor_id_t map_ids[1024];
+    int map_count = map_file != NULL ? load_sensor_ids(map_file, map_ids, 1024) : 0;
+    if (map_file != NULL && map_count == 0)
+    {
+        printf("Error: no sensor ids in %s.\n", map_file);
+        return EXIT_FAILURE;
+    }
+    for (int i = 0; i < count; i++)
+    {
+        sim.sensors[i].id = map_count > 0 ? map_ids[i % map_count] : first_id + i;
+        sim.sensors[i].value = INITIAL_TEMPERATURE;
+    }
+    raise_file_limit(count);
+    signal(SIGINT, on_interrupt);
+    signal(SIGTERM, on_interrupt);
+    srand48(time(NULL));
+
+    int64_t start = now_ns();
+    int64_t end = duration > 0 ? start + (int64_t)(duration * 1e9) : INT64_MAX;
+    int64_t next_arrival = start;
+    int64_t next_connect = start;
+    int64_t next_report = start + LOADGEN_REPORT_MS * 1000000LL;
+    int64_t last_report = start;
+    unsigned long last_sent = 0;
+    int opened = 0;
+    int next_sensor = 0;
+    double mean_gap = 1e9 / rate;
+
+    while (!interrupted)
+    {
+        int64_t now = now_ns();
+        if (now >= end) break;
+
+        while (opened < count && (connect_rate <= 0 || next_connect <= now))
+        {
+            sim_connect(&sim, &sim.sensors[opened++]);
+            if (connect_rate > 0) next_connect += (int64_t)(1e9 / connect_rate);
+        }
+        //reconnects share the pace of the ramp, but don't make up for the time nothing had to connect
+        if (opened == count && next_connect < now) next_connect = now;
+        while (sim.retry_count > 0 && sim.retries[sim.retry_head].at <= now && (connect_rate <= 0 || next_connect <= now))
+        {
+            sim_sensor_t *sensor = &sim.sensors[sim.retries[sim.retry_head].sensor];
+            sim.retry_head = (sim.retry_head + 1) % count;
+            sim.retry_count--;
+            sim.stats.reconnects++;
+            sim_connect(&sim, sensor);
+            if (connect_rate > 0) next_connect += (int64_t)(1e9 / connect_rate);
+        }
+
+        //a generator that falls behind still polls and reports in between
+        sensor_ts_t ts = time(NULL);
+        for (int burst = 0; next_arrival <= now && burst < 4096; burst++)
+        {
+            if (sim.connected == 0)
+            {
+                sim.stats.skipped++;
+            } else
+            {
+                while (sim.sensors[next_sensor].state != SIM_CONNECTED) next_sensor = (next_sensor + 1) % opened;
+                sim_send(&sim, &sim.sensors[next_sensor], ts);
+                next_sensor = (next_sensor + 1) % opened;
+            }
+            next_arrival += poisson ? (int64_t)(-log(1 - drand48()) * mean_gap) : (int64_t)mean_gap;
+        }
+
+        if (now >= next_report)
+        {
+            print_report(&sim, (now - start) / 1e9, sim.stats.sent - last_sent, (now - last_report) / 1e9, rate);
+            last_sent = sim.stats.sent;
+            last_report = now;
+            next_report += LOADGEN_REPORT_MS * 1000000LL;
+        }
+
+        int64_t wake = next_arrival < next_report ? next_arrival : next_report;
+        if (opened < count && connect_rate > 0 && next_connect < wake) wake = next_connect;
+        if (sim.retry_count > 0)
+        {
+            int64_t retry = sim.retries[sim.retry_head].at;
+            if (connect_rate > 0 && next_connect > retry) retry = next_connect;
+            if (retry < wake) wake = retry;
+        }
+        if (end < wake) wake = end;
+        now = now_ns();
+        sim_poll(&sim, wake > now ? (int)((wake - now + 999999) / 1000000) : 0);
+    }
+
+    int64_t now = now_ns();
+    printf("Summary: ");
+    print_report(&sim, (now - start) / 1e9, sim.stats.sent - last_sent, (now - last_report) / 1e9, rate);
+    for (int i = 0; i < opened; i++)
+    {
+        if (sim.sensors[i].state != SIM_CLOSED) sim_disconnect(&sim, &sim.sensors[i]);
+    }
+    close(sim.epfd);
+    free(sim.retries);
+    free(sim.sensors);
+    return EXIT_SUCCESS;
+}
+
+/**
+ * A reading of a trace, 'order' keeps readings with the same timestamp in file order
+ */
+typedef struct {
+    sensor_data_t data;
+    unsigned long order;
+} trace_reading_t;
+
+static int trace_compare(const void *x, const void *y)
+{
+    const trace_reading_t *a = x;
+    const trace_reading_t *b = y;
+    if (a->data.ts != b->data.ts) return a->data.ts < b->data.ts ? -1 : 1;
+    return a->order < b->order ? -1 : a->order > b->order;
+}
+
+/*
+ * Appends the "id value ts" lines of a sensor_log file to '*readings'
+ */
+static int load_trace(const char *path, trace_reading_t **readings, unsigned long *count, unsigned long *size)
+{
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) return 1;
+    sensor_data_t data;
+    long ts;
+    while (fscanf(fp, "%" SCNu16 " %lf %ld", &data.id, &data.value, &ts) == 3)
+    {
+        if (*count == *size)
+        {
+            *size = *size ? *size * 2 : 4096;
+            trace_reading_t *grown = realloc(*readings, *size * sizeof(trace_reading_t));
+            if (grown == NULL)
+            {
+                fclose(fp);
+                return 1;
+            }
+            *readings = grown;
+        }
+        data.ts = ts;
+        (*readings)[*count].data = data;
+        (*readings)[*count].order = *count;
+        (*count)++;
+    }
+    fclose(fp);
+    return 0;
+}
+
+static void print_replay_report(sim_t *sim, double elapsed, unsigned long total)
+{
+    printf("%.1f s: %lu of %lu readings replayed (%.0f/s), %d connected, %lu skipped, %lu errors, %lu closed by gateway, %lu reconnects\n",
+           elapsed, sim->stats.sent, total, sim->stats.sent / elapsed, sim->connected,
+           sim->stats.skipped, sim->stats.errors, sim->stats.closed, sim->stats.reconnects);
+    fflush(stdout);
+}
+
+static void print_replay_usage()
+{
+    printf("Use the trace replay with these options: sensor_node -T [options] server_ip server_port sensor_log...\n");
+    printf("\t%-15s : replay N times faster than recorded (default 1: original pace)\n", "-s N");
+    printf("\t%-15s : replay as fast as possible\n", "-f");
+    printf("\t%-15s : rewrite the timestamps to the time of sending, instead of keeping the recorded ones\n", "-w");
+}
+
+int replay_main(int argc, char *argv[])
+{
+    double speed = 1;
+    bool rewrite = false;
+    int option;
+
+    while ((option = getopt(argc, argv, "s:fw")) != -1)
+    {
+        switch (option)
+        {
+            case 's': speed = atof(optarg); break;
+            case 'f': speed = 0; break;
+            case 'w': rewrite = true; break;
+            default:
+                print_replay_usage();
+                return EXIT_FAILURE;
+        }
+    }
+    if (argc - optind < 3 || speed < 0)
+    {
+        print_replay_usage();
+        return EXIT_FAILURE;
+    }
+
+    trace_reading_t *readings = NULL;
+    unsigned long total = 0;
+    unsigned long size = 0;
+    for (int i = optind + 2; i < argc; i++)
+    {
+        if (load_trace(argv[i], &readings, &total, &size) != 0)
+        {
+            printf("Error: can't read %s.\n", argv[i]);
+            free(readings);
+            return EXIT_FAILURE;
+        }
+    }
+    if (total == 0)
+    {
+        printf("Error: no readings to replay.\n");
+        return EXIT_FAILURE;
+    }
+    qsort(readings, total, sizeof(trace_reading_t), trace_compare);
+
+    //one connection per sensor id of the trace, like the recorded sensor nodes, opened right before it is needed
+    sim_t sim;
+    memset(&sim, 0, sizeof(sim));
+    sim.server.sin_family = AF_INET;
+    sim.server.sin_port = htons(atoi(argv[optind + 1]));
+    if (inet_aton(argv[optind], &sim.server.sin_addr) == 0)
+    {
+        printf("Error: invalid server IP %s.\n", argv[optind]);
+        free(readings);
+        return EXIT_FAILURE;
+    }
+    int *sensor_of_id = malloc((UINT16_MAX + 1) * sizeof(int));
+    for (int id = 0; id <= UINT16_MAX; id++) sensor_of_id[id] = -1;
+    for (unsigned long i = 0; i < total; i++)
+    {
+        if (sensor_of_id[readings[i].data.id] == -1) sensor_of_id[readings[i].data.id] = sim.count++;
+    }
+    sim.sensors = calloc(sim.count, sizeof(sim_sensor_t));
+    sim.epfd = epoll_create1(0);
+    raise_file_limit(sim.count);
+    signal(SIGINT, on_interrupt);
+    signal(SIGTERM, on_interrupt);
+
+    int64_t start = now_ns();
+    int64_t next_report = start + LOADGEN_REPORT_MS * 1000000LL;
+    sensor_ts_t first_ts = readings[0].data.ts;
+    unsigned long next = 0;
+
+    while (!interrupted && next < total)
+    {
+        int64_t now = now_ns();
+        int64_t due = speed > 0 ? start + (int64_t)((readings[next].data.ts - first_ts) * 1e9 / speed) : now;
+        bool blocked = false;
+        while (next < total && due <= now)
+        {
+            sim_sensor_t *sensor = &sim.sensors[sensor_of_id[readings[next].data.id]];
+            //connect before the first reading, and again once the gateway closed an idle sensor, the reading
+            //waits in the backlog until the connect completes
+            if (sensor->state == SIM_CLOSED)
+            {
+                if (sensor->opened) sim.stats.reconnects++;
+                sensor->opened = true;
+                sim_connect(&sim, sensor);
+            }
+            //a trace isn't thinned out: wait for a full socket instead of skipping the reading
+            if (sensor->state != SIM_CLOSED && sim_backlog_full(sensor))
+            {
+                blocked = true;
+                break;
+            }
+            sensor_data_t data = readings[next].data;
+            if (rewrite) data.ts = time(NULL);
+            sim_queue(&sim, sensor, &data);
+            next++;
+            if (next < total && speed > 0) due = start + (int64_t)((readings[next].data.ts - first_ts) * 1e9 / speed);
+        }
+
+        if (now >= next_report)
+        {
+            print_replay_report(&sim, (now - start) / 1e9, total);
+            next_report += LOADGEN_REPORT_MS * 1000000LL;
+        }
+
+        //blocked on a full backlog the reading is overdue already, only the socket turning writable (or the next
+        //report) can move on, so wait for that instead of spinning
+        int64_t wake = !blocked && due < next_report ? due : next_report;
+        now = now_ns();
+        sim_poll(&sim, wake > now ? (int)((wake - now + 999999) / 1000000) : 0);
+    }
+
+    //let the backlogs drain before closing the connections
+    int64_t drain_until = now_ns() + 1000000000LL;
+    bool draining = true;
+    while (draining && now_ns() < drain_until)
+    {
+        draining = false;
+        for (int i = 0; i < sim.count; i++) draining |= sim.sensors[i].state != SIM_CLOSED && sim.sensors[i].pending > 0;
+        if (draining) sim_poll(&sim, 10);
+    }
+
+    printf("Summary: ");
+    print_replay_report(&sim, (now_ns() - start) / 1e9, total);
+    for (int i = 0; i < sim.count; i++)
+    {
+        if (sim.sensors[i].state != SIM_CLOSED) sim_disconnect(&sim, &sim.sensors[i]);
+    }
+    close(sim.epfd);
+    free(sim.sensors);
+    free(sensor_of_id);
+    free(readings);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,67 @@
+/**
+ * \author Koen Eelen
+ */
+
+#ifndef _SENSOR_LOADGEN_H_
+#define _SENSOR_LOADGEN_H_
+
+#include "config.h"
+
+#define INITIAL_TEMPERATURE   20
+#define TEMP_DEV    5 // max afwijking vorige temperatuur in 0.1 celsius
+
+/*
+ * Readings a simulated sensor keeps while its socket is full, further readings are skipped and counted
+ */
+#ifndef LOADGEN_BACKLOG
+#define LOADGEN_BACKLOG 16
+#endif
+
+/*
+ * Delay (in ms) before a sensor whose connection was closed or failed connects again, the reconnects are paced
+ * by -c like the ramp up
+ */
+#ifndef LOADGEN_RECONNECT_MS
+#define LOADGEN_RECONNECT_MS 1000
+#endif
+
+/*
+ * Interval (in ms) of the progress reports
+ */
+#ifndef LOADGEN_REPORT_MS
+#define LOADGEN_REPORT_MS 1000
+#endif
+
+/**
+ * Load-generator mode of sensor_node: one process simulates many sensors, each with its own connection,
+ * driven from a single epoll loop
+ *  sensor_node -L [-n sensors] [-r rate] [-P] [-c connects/s] [-d seconds] [-i first id | -m map file] server_ip server_port
+ * 'rate' is the aggregate number of readings per second, spread round-robin over the connected sensors, with fixed
+ * or (-P) exponentially distributed inter-arrival times. Progress and a final summary are printed to stdout.
+ * \param argc the number of arguments, argv[0] is the mode flag
+ * \param argv the arguments
+ * \return EXIT_SUCCESS, or EXIT_FAILURE for bad arguments
+ */
+int loadgen_main(int argc, char *argv[]);
+
+/**
+ * Trace replay mode of sensor_node: replays the "id value ts" lines of one or more sensor_log files
+ * (see LOG_SENSOR_DATA), merged in timestamp order, with one connection per sensor id. A sensor connects right
+ * before its first reading, and again before its next reading once the gateway closed the connection.
+ *  sensor_node -T [-s N | -f] [-w] server_ip server_port sensor_log...
+ * The readings are sent at the recorded pace, N times faster (-s N) or as fast as possible (-f). The recorded
+ * timestamps are kept, or rewritten to the time of sending (-w).
+ * \param argc the number of arguments, argv[0] is the mode flag
+ * \param argv the arguments
+ * \return EXIT_SUCCESS, or EXIT_FAILURE for bad arguments or unreadable logs
+ */
+int replay_main(int argc, char *argv[]);
+
+/**
+ * Encodes a reading in the wire format
+ * \param buf at least SENSOR_RECORD_BYTES bytes
+ * \param data the reading
+ */
+void sensor_record_encode(char *buf, const sensor_data_t *data);
+
+#endif /* _SENSOR_LOADGEN_H_ */
@@ -5,9 +5,13 @@
 #include <time.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <signal.h>
+#include <errno.h>
 #include <sys/stat.h>
+#include <sys/socket.h>
 #include <fcntl.h>
 #include "config.h"
+#include "sensor_loadgen.h"
 #include "lib/tcpsock.h"
 
 // conditional compilation option to control the number of measurements this sensor node wil generate
@@ -47,9 +51,30 @@
   #define LOG_CLOSE(...) (void)0
 #endif
 
-#define INITIAL_TEMPERATURE   20
-#define TEMP_DEV    5 // max afwijking vorige temperatuur in 0.1 celsius
+// readings kept while they can't be sent, the oldest reading is dropped when the ring is full
+#ifndef RING_SIZE
+  #define RING_SIZE 128
+#endif
+
+// readings are collected and sent with one write() every FLUSH_INTERVAL seconds, 0 sends every reading right away
+#ifndef FLUSH_INTERVAL
+  #define FLUSH_INTERVAL 0
+#endif
+
+// reconnect delay: random between 0 and RECONNECT_MIN_MS * 2^attempt ms, capped at RECONNECT_MAX_MS
+#ifndef RECONNECT_MIN_MS
+  #define RECONNECT_MIN_MS 500
+#endif
+#ifndef RECONNECT_MAX_MS
+  #define RECONNECT_MAX_MS 30000
+#endif
 
+typedef struct {
+        sensor_data_t readings[RING_SIZE];
+        int head;       // oldest reading
+        int count;
+        unsigned long dropped;
+} ring_t;
 
 void print_help(void);
 
@@ -58,16 +83,102 @@ void print_help(void);
  * argv[2] = sleep time
  * argv[3] = server IP
  * argv[4] = server port
+ *
+ * or the load generator: argv[1] = -L, see loadgen_main()
+ * or the trace replay: argv[1] = -T, see replay_main()
  */
 
+static int64_t now_ms(void)
+{
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        return now.tv_sec * 1000LL + now.tv_nsec / 1000000;
+}
+
+static void ring_push(ring_t *ring, sensor_data_t *data)
+{
+        if (ring->count == RING_SIZE)
+        {
+                ring->head = (ring->head + 1) % RING_SIZE;
+                ring->count--;
+                ring->dropped++;
+        }
+        ring->readings[(ring->head + ring->count) % RING_SIZE] = *data;
+        ring->count++;
+}
+
+/*
+ * Jittered exponential backoff, so nodes that lost the same gateway don't all reconnect at the same moment
+ */
+static int64_t reconnect_delay(int attempt)
+{
+        int64_t limit = RECONNECT_MIN_MS;
+        while (attempt-- > 0 && limit < RECONNECT_MAX_MS) limit *= 2;
+        if (limit > RECONNECT_MAX_MS) limit = RECONNECT_MAX_MS;
+        return (int64_t)(drand48() * limit);
+}
+
+/*
+ * A gateway that closed the connection is only noticed by the next send, which would still succeed once
+ */
+static int connection_closed(tcpsock_t *client)
+{
+        char byte;
+        int sd;
+        if (tcp_get_sd(client, &sd) != TCP_NO_ERROR) return 1;
+        ssize_t result = recv(sd, &byte, 1, MSG_PEEK | MSG_DONTWAIT);
+        return result == 0 || (result < 0 && errno != EAGAIN && errno != EWOULDBLOCK);
+}
+
+/*
+ * Sends all readings of the ring with one write(), in this order (!!): <sensor_id><temperature><timestamp>
+ * remark: don't send as a struct!
+ * The readings are encoded in one flat buffer, an iovec per field would exceed IOV_MAX for a big RING_SIZE
+ * If the send fails, the readings that were written completely are dropped from the ring, the rest (including one
+ * that was only partly written) stay in the ring and are sent again after reconnecting
+ */
+static int ring_flush(ring_t *ring, tcpsock_t *client)
+{
+        static char buf[RING_SIZE * SENSOR_RECORD_BYTES];
+        size_t total = 0;
+        int sd;
+
+        if (ring->count == 0) return TCP_NO_ERROR;
+        if (tcp_get_sd(client, &sd) != TCP_NO_ERROR) return TCP_SOCKET_ERROR;
+        for (int k = 0; k < ring->count; k++)
+        {
+                sensor_record_encode(buf + total, &ring->readings[(ring->head + k) % RING_SIZE]);
+                total += SENSOR_RECORD_BYTES;
+        }
+        size_t written = 0;
+        while (written < total)
+        {
+                ssize_t sent = write(sd, buf + written, total - written);
+                if (sent < 0)
+                {
+                        if (errno == EINTR) continue;
+                        break;
+                }
+                written += sent;
+        }
+        int done = written / SENSOR_RECORD_BYTES;
+        ring->head = (ring->head + done) % RING_SIZE;
+        ring->count -= done;
+        return ring->count == 0 ? TCP_NO_ERROR : TCP_SOCKOP_ERROR;
+}
+
 int main( int argc, char *argv[] )
 {
-        //  printf("test1\n");
         sensor_data_t data;
         int server_port;
         char server_ip[] = "000.000.000.000";
-        tcpsock_t * client;
-        int i, bytes,sleep_time;
+        tcpsock_t * client = NULL;
+        int i, sleep_time;
+        ring_t ring = { .head = 0, .count = 0, .dropped = 0 };
+        int attempt = 0;
+
+        if (argc > 1 && strcmp(argv[1], "-L") == 0) exit(loadgen_main(argc - 1, argv + 1));
+        if (argc > 1 && strcmp(argv[1], "-T") == 0) exit(replay_main(argc - 1, argv + 1));
 
         LOG_OPEN();
 
@@ -85,34 +196,66 @@ int main( int argc, char *argv[] )
                 server_port = atoi(argv[4]);
         }
 
-        srand48( time(NULL) );
-        //    printf("test2\n");
+        srand48( time(NULL) ^ getpid() );
+        // a send to a gateway that went away must fail with an error, not kill the node
+        signal(SIGPIPE, SIG_IGN);
 
-        // open TCP connection to the server; server is listening to SERVER_IP and PORT
-        if (tcp_active_open(&client,server_port,server_ip )!=TCP_NO_ERROR) exit(EXIT_FAILURE);
         data.value = INITIAL_TEMPERATURE;
+        int64_t next_measurement = now_ms();
+        int64_t next_flush = next_measurement;
+        int64_t next_connect = next_measurement;
         i=LOOPS;
         while(i)
         {
-                data.value = data.value + TEMP_DEV * ((drand48() - 0.5)/10);
-                time(&data.ts);
-                //  printf("test3\n");
-                // send data to server in this order (!!): <sensor_id><temperature><timestamp>
-                // remark: don't send as a struct!
-                bytes = sizeof(data.id);
-                if (tcp_send( client,(void *)&data.id,&bytes)!=TCP_NO_ERROR) exit(EXIT_FAILURE);
-                //printf("test4\n");
-                bytes = sizeof(data.value);
-                if (tcp_send(client,(void *)&data.value,&bytes)!=TCP_NO_ERROR) exit(EXIT_FAILURE);
-                bytes = sizeof(data.ts);
-                if (tcp_send(client,(void *)&data.ts,&bytes)!=TCP_NO_ERROR) exit(EXIT_FAILURE);
-                LOG_PRINTF(data.id,data.value,data.ts);
-                sleep(sleep_time);
-                UPDATE(i);
+                int64_t now = now_ms();
+                if (now >= next_measurement)
+                {
+                        data.value = data.value + TEMP_DEV * ((drand48() - 0.5)/10);
+                        time(&data.ts);
+                        ring_push(&ring, &data);
+                        LOG_PRINTF(data.id,data.value,data.ts);
+                        next_measurement += sleep_time * 1000LL;
+                        UPDATE(i);
+                }
+
+                // open TCP connection to the server; server is listening to SERVER_IP and PORT
+                if (client == NULL && now >= next_connect)
+                {
+                        if (tcp_active_open(&client,server_port,server_ip) != TCP_NO_ERROR)
+                        {
+                                client = NULL;
+                                next_connect = now + reconnect_delay(attempt++);
+                        } else
+                        {
+                                attempt = 0;
+                                next_flush = now;       // replay what was buffered while disconnected
+                        }
+                }
+
+                if (client != NULL && (now >= next_flush || !i))
+                {
+                        if (connection_closed(client) || ring_flush(&ring, client) != TCP_NO_ERROR)
+                        {
+                                tcp_close(&client);
+                                client = NULL;
+                                next_connect = now + reconnect_delay(attempt++);
+                        }
+                        next_flush = now + FLUSH_INTERVAL * 1000LL;
+                }
 
+                int64_t wake = next_measurement;
+                if (client == NULL && next_connect < wake) wake = next_connect;
+                if (client != NULL && ring.count > 0 && next_flush < wake) wake = next_flush;
+                now = now_ms();
+                if (i && wake > now)
+                {
+                        struct timespec pause = { (wake - now) / 1000, ((wake - now) % 1000) * 1000000L };
+                        nanosleep(&pause, NULL);
+                }
         }
-        //  printf("uit loop\n");
-        if (tcp_close( &client )!=TCP_NO_ERROR) exit(EXIT_FAILURE);
+        if (ring.count > 0) printf("%d readings could not be sent\n", ring.count);
+        if (ring.dropped > 0) printf("%lu readings dropped, the buffer was full\n", ring.dropped);
+        if (client != NULL && tcp_close( &client )!=TCP_NO_ERROR) exit(EXIT_FAILURE);
 
         LOG_CLOSE();
 
@@ -127,4 +270,6 @@ void print_help(void)
         printf("\t%-15s : node sleep time (in sec) between two measurements\n","\'sleep time\'");
         printf("\t%-15s : TCP server IP address\n", "\'server IP\'");
         printf("\t%-15s : TCP server port number\n", "\'server port\'");
+        printf("Or simulate many sensors from one process: sensor_node -L [options] server_ip server_port\n");
+        printf("Or replay recorded sensor logs: sensor_node -T [options] server_ip server_port sensor_log...\n");
 }
@@ -0,0 +1,326 @@
+/**
+ * \author Koen Eelen
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "sensor_tsdb.h"
+
+#define SENSOR_COUNT 65536                          // every possible sensor_id_t
+#define BLOCK_BYTES (16 + TSDB_BLOCK_POINTS * 17)   // 2 raw header words + worst case 136 bits per reading
+#define PATH_LENGTH 512
+
+/**
+ * The open (not yet written) block of a sensor, together with the encoder state
+ */
+typedef struct {
+    uint8_t buf[BLOCK_BYTES];
+    uint64_t bits;                  /**< number of bits used in 'buf' */
+    uint32_t count;
+    int64_t min_ts, max_ts;
+    int64_t prev_ts, prev_delta;
+    int64_t prev_value;             /**< in 1/TSDB_VALUE_SCALE units */
+} block_t;
+
+/**
+ * Decoder state, mirrors the encoder state of block_t
+ */
+typedef struct {
+    const uint8_t *buf;
+    uint64_t bits;
+    uint32_t count;
+    int64_t prev_ts, prev_delta;
+    int64_t prev_value;
+} reader_t;
+
+struct tsdb {
+    char dir[PATH_LENGTH - 16];     /**< leaves room for "/<id>.idx" */
+    pthread_mutex_t lock;
+    block_t **blocks;               /**< open block per sensor id, NULL if the sensor has none */
+};
+
+static int seal_block(tsdb_t *db, sensor_id_t id, block_t *block);
+static void encode(block_t *block, int64_t ts, double value);
+static void decode(reader_t *reader, int64_t *ts, double *value);
+static int query_block(const uint8_t *buf, uint32_t count, sensor_id_t id, sensor_ts_t from, sensor_ts_t to, tsdb_callback_t f, void *arg);
+
+tsdb_t *tsdb_open(const char *dir)
+{
+    if (mkdir(dir, 0755) != 0 && errno != EEXIST) return NULL;
+    tsdb_t *db = malloc(sizeof(tsdb_t));
+    assert(db != NULL);
+    snprintf(db->dir, sizeof(db->dir), "%s", dir);
+    pthread_mutex_init(&db->lock, NULL);
+    db->blocks = calloc(SENSOR_COUNT, sizeof(block_t *));
+    assert(db->blocks != NULL);
+    return db;
+}
+
+int tsdb_append(tsdb_t *db, const sensor_data_t *data)
+{
+    int result = 0;
+    pthread_mutex_lock(&db->lock);
+    block_t *block = db->blocks[data->id];
+    if (block == NULL)
+    {
+        block = malloc(sizeof(block_t));
+        assert(block != NULL);
+        block->count = 0;
+        db->blocks[data->id] = block;
+    }
+    encode(block, data->ts, data->value);
+    if (block->count == TSDB_BLOCK_POINTS) result = seal_block(db, data->id, block);
+    pthread_mutex_unlock(&db->lock);
+    return result;
+}
+
+int tsdb_flush(tsdb_t *db)
+{
+    int result = 0;
+    pthread_mutex_lock(&db->lock);
+    for (int id = 0; id < SENSOR_COUNT; id++)
+    {
+        if (db->blocks[id] != NULL && db->blocks[id]->count > 0) result |= seal_block(db, id, db->blocks[id]);
+    }
+    pthread_mutex_unlock(&db->lock);
+    return result;
+}
+
+void tsdb_close(tsdb_t **db)
+{
+    tsdb_flush(*db);
+    for (int id = 0; id < SENSOR_COUNT; id++) free((*db)->blocks[id]);
+    free((*db)->blocks);
+    pthread_mutex_destroy(&(*db)->lock);
+    free(*db);
+    *db = NULL;
+}
+
+/*
+ * Appends the block to the data file and then its entry to the index, an index entry never points past the data
+ */
+static int seal_block(tsdb_t *db, sensor_id_t id, block_t *block)
+{
+    char path[PATH_LENGTH];
+    tsdb_index_t entry;
+    entry.min_ts = block->min_ts;
+    entry.max_ts = block->max_ts;
+    entry.bytes = (block->bits + 7) / 8;
+    entry.count = block->count;
+    block->count = 0;
+
+    snprintf(path, PATH_LENGTH, "%s/%u.dat", db->dir, id);
+    int fd = open(path, O_WRONLY | O_APPEND | O_CREAT, 0644);
+    if (fd < 0) return 1;
+    off_t offset = lseek(fd, 0, SEEK_END);
+    ssize_t written = write(fd, block->buf, entry.bytes);
+    int synced = fdatasync(fd);
+    close(fd);
+    if (offset < 0 || written != entry.bytes || synced != 0) return 1;
+    entry.offset = offset;
+
+    snprintf(path, PATH_LENGTH, "%s/%u.idx", db->dir, id);
+    fd = open(path, O_WRONLY | O_APPEND | O_CREAT, 0644);
+    if (fd < 0) return 1;
+    written = write(fd, &entry, sizeof(tsdb_index_t));
+    synced = fdatasync(fd);
+    close(fd);
+    return written == sizeof(tsdb_index_t) && synced == 0 ? 0 : 1;
+}
+
+int tsdb_query(tsdb_t *db, sensor_id_t id, sensor_ts_t from, sensor_ts_t to, tsdb_callback_t f, void *arg)
+{
+    char path[PATH_LENGTH];
+    struct stat st;
+    int result = 0;
+
+    snprintf(path, PATH_LENGTH, "%s/%u.idx", db->dir, id);
+    int idx_fd = open(path, O_RDONLY);
+    snprintf(path, PATH_LENGTH, "%s/%u.dat", db->dir, id);
+    int dat_fd = open(path, O_RDONLY);
+    if (idx_fd >= 0 && dat_fd >= 0 && fstat(idx_fd, &st) == 0 && st.st_size >= sizeof(tsdb_index_t))
+    {
+        size_t idx_size = st.st_size - st.st_size % sizeof(tsdb_index_t);
+        tsdb_index_t *index = mmap(NULL, idx_size, PROT_READ, MAP_PRIVATE, idx_fd, 0);
+        size_t dat_size = (fstat(dat_fd, &st) == 0) ? st.st_size : 0;
+        uint8_t *data = dat_size > 0 ? mmap(NULL, dat_size, PROT_READ, MAP_PRIVATE, dat_fd, 0) : MAP_FAILED;
+        if (index == MAP_FAILED || data == MAP_FAILED)
+        {
+            result = 1;
+        } else
+        {
+            for (size_t i = 0; result == 0 && i < idx_size / sizeof(tsdb_index_t); i++)
+            {
+                if (index[i].max_ts < from || index[i].min_ts > to) continue;
+                if (index[i].offset + index[i].bytes > dat_size) break;
+                result = query_block(data + index[i].offset, index[i].count, id, from, to, f, arg);
+            }
+        }
+        if (index != MAP_FAILED) munmap(index, idx_size);
+        if (data != MAP_FAILED) munmap(data, dat_size);
+    }
+    if (idx_fd >= 0) close(idx_fd);
+    if (dat_fd >= 0) close(dat_fd);
+
+    pthread_mutex_lock(&db->lock);
+    block_t *block = db->blocks[id];
+    if (result == 0 && block != NULL && block->count > 0 && block->max_ts >= from && block->min_ts <= to)
+    {
+        result = query_block(block->buf, block->count, id, from, to, f, arg);
+    }
+    pthread_mutex_unlock(&db->lock);
+    return result < 0 ? 0 : result;
+}
+
+/*
+ * Returns 0 when the block is done, -1 when the callback stopped the query
+ */
+static int query_block(const uint8_t *buf, uint32_t count, sensor_id_t id, sensor_ts_t from, sensor_ts_t to, tsdb_callback_t f, void *arg)
+{
+    reader_t reader = {.buf = buf, .bits = 0, .count = 0};
+    for (uint32_t i = 0; i < count; i++)
+    {
+        int64_t ts;
+        double value;
+        decode(&reader, &ts, &value);
+        if (ts < from || ts > to) continue;
+        sensor_data_t data = {.id = id, .value = value, .ts = ts};
+        if (f(&data, arg) != 0) return -1;
+    }
+    return 0;
+}
+
+
+/*
+ * Bit level encoding, most significant bit first
+ */
+static void write_bits(block_t *block, uint64_t value, int n)
+{
+    for (int i = n - 1; i >= 0; i--)
+    {
+        uint64_t byte = block->bits >> 3;
+        int shift = 7 - (block->bits & 7);
+        if (shift == 7) block->buf[byte] = 0;
+        block->buf[byte] |= ((value >> i) & 1) << shift;
+        block->bits++;
+    }
+}
+
+static uint64_t read_bits(reader_t *reader, int n)
+{
+    uint64_t value = 0;
+    for (int i = 0; i < n; i++)
+    {
+        int bit = (reader->buf[reader->bits >> 3] >> (7 - (reader->bits & 7))) & 1;
+        value = (value << 1) | bit;
+        reader->bits++;
+    }
+    return value;
+}
+
+/*
+ * Values are stored as integers in 1/TSDB_VALUE_SCALE units, rounded half away from zero
+ */
+static int64_t quantize(double value)
+{
+    double scaled = value * TSDB_VALUE_SCALE;
+    if (!(scaled > INT32_MIN)) scaled = INT32_MIN;      // also catches NaN
+    if (scaled > INT32_MAX) scaled = INT32_MAX;
+    return (int64_t)(scaled < 0 ? scaled - 0.5 : scaled + 0.5);
+}
+
+/*
+ * Zigzag mapping of signed deltas, small magnitudes of either sign become small unsigned numbers
+ */
+static uint64_t zigzag(int64_t value)
+{
+    return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+static int64_t unzigzag(uint64_t value)
+{
+    return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+static void encode(block_t *block, int64_t ts, double value)
+{
+    int64_t quantized = quantize(value);
+    if (block->count == 0)
+    {
+        block->bits = 0;
+        write_bits(block, ts, 64);
+        write_bits(block, quantized, 64);
+        block->min_ts = block->max_ts = block->prev_ts = ts;
+        block->prev_delta = 0;
+        block->prev_value = quantized;
+        block->count = 1;
+        return;
+    }
+
+    //timestamp: delta-of-delta with a variable length prefix
+    int64_t delta = ts - block->prev_ts;
+    int64_t dod = delta - block->prev_delta;
+    if (dod == 0) write_bits(block, 0, 1);
+    else if (dod >= -64 && dod <= 63) { write_bits(block, 0x2, 2); write_bits(block, dod, 7); }
+    else if (dod >= -256 && dod <= 255) { write_bits(block, 0x6, 3); write_bits(block, dod, 9); }
+    else if (dod >= -2048 && dod <= 2047) { write_bits(block, 0xE, 4); write_bits(block, dod, 12); }
+    else { write_bits(block, 0xF, 4); write_bits(block, dod, 64); }
+    block->prev_delta = delta;
+    block->prev_ts = ts;
+    if (ts < block->min_ts) block->min_ts = ts;
+    if (ts > block->max_ts) block->max_ts = ts;
+
+    //value: zigzag delta against the previous value with the same kind of prefix
+    uint64_t zz = zigzag(quantized - block->prev_value);
+    block->prev_value = quantized;
+    if (zz == 0) write_bits(block, 0, 1);
+    else if (zz < (1 << 4)) { write_bits(block, 0x2, 2); write_bits(block, zz, 4); }
+    else if (zz < (1 << 8)) { write_bits(block, 0x6, 3); write_bits(block, zz, 8); }
+    else if (zz < (1 << 16)) { write_bits(block, 0xE, 4); write_bits(block, zz, 16); }
+    else { write_bits(block, 0xF, 4); write_bits(block, zz, 64); }
+    block->count++;
+}
+
+static int64_t sign_extend(uint64_t value, int n)
+{
+    return (int64_t)(value << (64 - n)) >> (64 - n);
+}
+
+static void decode(reader_t *reader, int64_t *ts, double *value)
+{
+    if (reader->count == 0)
+    {
+        reader->prev_ts = read_bits(reader, 64);
+        reader->prev_value = read_bits(reader, 64);
+        reader->prev_delta = 0;
+    } else
+    {
+        int64_t dod;
+        if (read_bits(reader, 1) == 0) dod = 0;
+        else if (read_bits(reader, 1) == 0) dod = sign_extend(read_bits(reader, 7), 7);
+        else if (read_bits(reader, 1) == 0) dod = sign_extend(read_bits(reader, 9), 9);
+        else if (read_bits(reader, 1) == 0) dod = sign_extend(read_bits(reader, 12), 12);
+        else dod = read_bits(reader, 64);
+        reader->prev_delta += dod;
+        reader->prev_ts += reader->prev_delta;
+
+        uint64_t zz;
+        if (read_bits(reader, 1) == 0) zz = 0;
+        else if (read_bits(reader, 1) == 0) zz = read_bits(reader, 4);
+        else if (read_bits(reader, 1) == 0) zz = read_bits(reader, 8);
+        else if (read_bits(reader, 1) == 0) zz = read_bits(reader, 16);
+        else zz = read_bits(reader, 64);
+        reader->prev_value += unzigzag(zz);
+    }
+    reader->count++;
+    *ts = reader->prev_ts;
+    *value = (double)reader->prev_value / TSDB_VALUE_SCALE;
+}
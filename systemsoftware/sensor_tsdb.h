@@ -0,0 +1,90 @@
+/**
+ * \author Koen Eelen
+ */
+
+#ifndef _SENSOR_TSDB_H_
+#define _SENSOR_TSDB_H_
+
+#include <stdint.h>
+#include "config.h"
+
+/*
+ * Append-only columnar time-series store, an alternative to SQLite for high-rate deployments
+ * Every sensor gets 2 files in TSDB_DIR:
+ *  - <id>.dat: compressed blocks of at most TSDB_BLOCK_POINTS readings, timestamps are delta-of-delta
+ *    encoded and values are rounded to 1/TSDB_VALUE_SCALE and stored as zigzag deltas against the previous value
+ *  - <id>.idx: sparse index with one tsdb_index_t entry per block, used to seek time ranges
+ * A block is only written once it is full (or on tsdb_flush()/tsdb_close()), the open block lives in memory.
+ * Written blocks are synced to disk before their index entry is considered stored. TSDB_DIR is defined in config.h.
+ */
+
+#ifndef TSDB_BLOCK_POINTS
+#define TSDB_BLOCK_POINTS 512
+#endif
+
+// the precision of stored values, centi-degrees like the COMPACT_RECORDS wire format
+#ifndef TSDB_VALUE_SCALE
+#define TSDB_VALUE_SCALE 100
+#endif
+
+/*
+ * Sparse index entry, describes one block in the data file
+ */
+typedef struct {
+    int64_t min_ts;
+    int64_t max_ts;
+    uint64_t offset;                /**< offset of the block in the data file */
+    uint32_t bytes;                 /**< size of the block in bytes */
+    uint32_t count;                 /**< number of readings in the block */
+} tsdb_index_t;
+
+typedef struct tsdb tsdb_t;
+
+/**
+ * Callback for tsdb_query(), a non-zero return value stops the query
+ */
+typedef int (*tsdb_callback_t)(const sensor_data_t *data, void *arg);
+
+/**
+ * Opens (and creates if needed) a store in directory 'dir'
+ * \param dir the directory that holds the column files
+ * \return the store, NULL if the directory can't be created
+ */
+tsdb_t *tsdb_open(const char *dir);
+
+/**
+ * Appends a reading to the open block of its sensor, the block is written out once it holds TSDB_BLOCK_POINTS readings
+ * \param db the store
+ * \param data the reading
+ * \return zero for success, and non-zero if an error occurs
+ */
+int tsdb_append(tsdb_t *db, const sensor_data_t *data);
+
+/**
+ * Writes out and syncs the open block of every sensor, the next reading of a sensor starts a new block
+ * \param db the store
+ * \return zero for success, and non-zero if an error occurs
+ */
+int tsdb_flush(tsdb_t *db);
+
+/**
+ * Flushes the store and frees all its resources, '*db' is set to NULL
+ * \param db a double pointer to the store
+ */
+void tsdb_close(tsdb_t **db);
+
+/**
+ * Calls 'f' for every reading of sensor 'id' with a timestamp between 'from' and 'to' (inclusive)
+ * Written blocks are read through a memory map, only the blocks the index says overlap the range are decoded
+ * Readings are returned in insertion order
+ * \param db the store
+ * \param id the sensor id to be queried
+ * \param from the start of the time range
+ * \param to the end of the time range
+ * \param f callback function that handles a reading
+ * \param arg passed on to 'f'
+ * \return zero for success, and non-zero if an error occurs
+ */
+int tsdb_query(tsdb_t *db, sensor_id_t id, sensor_ts_t from, sensor_ts_t to, tsdb_callback_t f, void *arg);
+
+#endif /* _SENSOR_TSDB_H_ */
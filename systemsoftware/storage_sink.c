@@ -0,0 +1,320 @@
+/**
+ * \author Koen Eelen
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <assert.h>
+#include <pthread.h>
+#include "storage_sink.h"
+#include "sensor_tsdb.h"
+#include "logger.h"
+
+/**
+ * One half of the double buffer between the storagemgr consumer and its writer thread
+ */
+typedef struct {
+    sensor_data_t rows[DB_BATCH_SIZE];
+    int count;
+    struct timespec first_row;      /**< time at which the first row was added */
+} batch_t;
+
+/**
+ * Hand-off between the consumer and the writer thread
+ */
+typedef struct {
+    const storage_sink_t *sink;
+    void *state;
+    storage_stats_t *stats;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    batch_t *commit;                /**< the batch the writer is writing, NULL if it is idle */
+    batch_t *done;                  /**< the batch the writer wrote last, free to be filled again */
+    bool stop;
+} writer_t;
+
+static void *storage_writer(void *arg);
+static void hand_off_batch(writer_t *writer, batch_t **fill);
+static double elapsed_ms(struct timespec *since);
+
+
+/*
+ * The consumer fills one batch while the writer thread writes the other one, so a slow sink
+ * doesn't hold up the sbuffer until both batches are full
+ */
+int storage_sink_consume(const storage_sink_t *sink, void *state, sbuffer_t *sbuffer, int storagemgr_id, storage_stats_t *stats)
+{
+    memset(stats, 0, sizeof(storage_stats_t));
+    writer_t writer = {.sink = sink, .state = state, .stats = stats, .commit = NULL, .stop = false};
+    pthread_mutex_init(&writer.lock, NULL);
+    pthread_cond_init(&writer.cond, NULL);
+    batch_t *fill = malloc(sizeof(batch_t));
+    writer.done = malloc(sizeof(batch_t));
+    assert(fill != NULL && writer.done != NULL);
+    fill->count = 0;
+    pthread_t writer_thread;
+    pthread_create(&writer_thread, NULL, storage_writer, &writer);
+
+    time_t last_upload = time(NULL);
+    bool terminate = false;
+    while(!terminate)
+    {
+        sensor_data_t data;
+        int reading = sbuffer_consume(sbuffer, &data, storagemgr_id);
+        if(reading==SBUFFER_SUCCESS)
+        {
+            last_upload = time(NULL);
+            if (fill->count == 0) clock_gettime(CLOCK_MONOTONIC, &fill->first_row);
+            fill->rows[fill->count++] = data;
+        }
+        if (fill->count == DB_BATCH_SIZE || (fill->count > 0 && elapsed_ms(&fill->first_row) >= DB_BATCH_MS))
+        {
+            hand_off_batch(&writer, &fill);
+        }
+
+        if(last_upload + TIMEOUT < time(NULL))
+        {
+            printf("STORAGEMGR TIMEOUT\n");
+            terminate = true;
+        }
+    }
+    if (fill->count > 0) hand_off_batch(&writer, &fill);
+
+    pthread_mutex_lock(&writer.lock);
+    writer.stop = true;
+    pthread_cond_broadcast(&writer.cond);
+    pthread_mutex_unlock(&writer.lock);
+    pthread_join(writer_thread, NULL);
+    pthread_cond_destroy(&writer.cond);
+    pthread_mutex_destroy(&writer.lock);
+    free(fill);
+    free(writer.done);
+
+    int result = sink->flush(state);
+    if (sink->stats != NULL) sink->stats(state, stats);
+    return result;
+}
+
+
+/*
+ * Gives the filled batch to the writer and takes back the batch it wrote last,
+ * waits if the writer is still busy with that one
+ */
+static void hand_off_batch(writer_t *writer, batch_t **fill)
+{
+    pthread_mutex_lock(&writer->lock);
+    if (writer->commit != NULL)
+    {
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        while (writer->commit != NULL) pthread_cond_wait(&writer->cond, &writer->lock);
+        writer->stats->swap_waits++;
+        writer->stats->swap_wait_ms += elapsed_ms(&start);
+    }
+    writer->commit = *fill;
+    *fill = writer->done;
+    (*fill)->count = 0;
+    writer->done = NULL;
+    pthread_cond_broadcast(&writer->cond);
+    pthread_mutex_unlock(&writer->lock);
+}
+
+
+static void *storage_writer(void *arg)
+{
+    writer_t *writer = arg;
+    pthread_mutex_lock(&writer->lock);
+    while (true)
+    {
+        while (writer->commit == NULL && !writer->stop) pthread_cond_wait(&writer->cond, &writer->lock);
+        if (writer->commit == NULL) break;
+        batch_t *batch = writer->commit;
+        pthread_mutex_unlock(&writer->lock);
+
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        if (writer->sink->write_batch(writer->state, batch->rows, batch->count) != 0)
+        {
+            printf("Failed to store %d rows.\n", batch->count);
+            logger_event(LOG_STORE_FAILED, 0, batch->count, 0);
+        } else
+        {
+            //the consumer only touches the swap wait fields, and only while holding the lock
+            double commit_ms = elapsed_ms(&start);
+            writer->stats->batches++;
+            writer->stats->rows += batch->count;
+            writer->stats->last_batch_size = batch->count;
+            writer->stats->last_commit_ms = commit_ms;
+            writer->stats->total_commit_ms += commit_ms;
+            if (commit_ms > writer->stats->max_commit_ms) writer->stats->max_commit_ms = commit_ms;
+        }
+
+        pthread_mutex_lock(&writer->lock);
+        writer->done = batch;
+        writer->commit = NULL;
+        pthread_cond_broadcast(&writer->cond);
+    }
+    pthread_mutex_unlock(&writer->lock);
+    return NULL;
+}
+
+
+static double elapsed_ms(struct timespec *since)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - since->tv_sec) * 1e3 + (now.tv_nsec - since->tv_nsec) / 1e6;
+}
+
+
+/*
+ * "sqlite": a DBCONN, batches are committed by insert_sensor_batch() and spooled while the database is down
+ */
+static void *sqlite_open(sbuffer_t *sbuffer)
+{
+    return init_connection(1, sbuffer);
+}
+
+static int sqlite_write_batch(void *sink, sensor_data_t *rows, int count)
+{
+    return insert_sensor_batch(sink, rows, count);
+}
+
+static int sqlite_flush(void *sink)
+{
+    return flush_sensor(sink);
+}
+
+static void sqlite_close(void *sink)
+{
+    disconnect(sink);
+}
+
+static void sqlite_stats(void *sink, storage_stats_t *stats)
+{
+    storage_stats_t conn_stats;
+    get_storage_stats(sink, &conn_stats);
+    stats->spooled = conn_stats.spooled;
+    stats->replayed = conn_stats.replayed;
+    stats->reconnects = conn_stats.reconnects;
+    stats->quarantined = conn_stats.quarantined;
+}
+
+
+/*
+ * "tsdb": a block is written out when it is full, flush writes out the open (partial) blocks as well
+ */
+static void *tsdb_sink_open(sbuffer_t *sbuffer)
+{
+    return tsdb_open(TO_STRING(TSDB_DIR));
+}
+
+static int tsdb_sink_write_batch(void *sink, sensor_data_t *rows, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        if (tsdb_append(sink, &rows[i]) != 0) return 1;
+    }
+    return 0;
+}
+
+static int tsdb_sink_flush(void *sink)
+{
+    return tsdb_flush(sink);
+}
+
+static void tsdb_sink_close(void *sink)
+{
+    tsdb_close((tsdb_t **)&sink);
+}
+
+
+/*
+ * "file": a segment file, every batch is handed to the OS right away, flush waits for the disk
+ */
+typedef struct {
+    FILE *fp;
+    sensor_ts_t epoch;
+} file_sink_t;
+
+static void *file_open(sbuffer_t *sbuffer)
+{
+    file_sink_t *file = malloc(sizeof(file_sink_t));
+    assert(file != NULL);
+    file->fp = sensor_segment_append(TO_STRING(FILE_SINK_NAME), &file->epoch);
+    if (file->fp == NULL)
+    {
+        free(file);
+        return NULL;
+    }
+    return file;
+}
+
+static int file_write_batch(void *sink, sensor_data_t *rows, int count)
+{
+    file_sink_t *file = sink;
+    if (sensor_segment_write(file->fp, rows, count, file->epoch) != 0) return 1;
+    return fflush(file->fp) != 0;
+}
+
+static int file_flush(void *sink)
+{
+    file_sink_t *file = sink;
+    if (fflush(file->fp) != 0) return 1;
+    return fdatasync(fileno(file->fp)) != 0;
+}
+
+static void file_close(void *sink)
+{
+    file_sink_t *file = sink;
+    fclose(file->fp);
+    free(file);
+}
+
+
+/*
+ * "null": the state is just a row counter
+ */
+static void *null_open(sbuffer_t *sbuffer)
+{
+    unsigned long *rows = calloc(1, sizeof(unsigned long));
+    assert(rows != NULL);
+    return rows;
+}
+
+static int null_write_batch(void *sink, sensor_data_t *rows, int count)
+{
+    *(unsigned long *)sink += count;
+    return 0;
+}
+
+static int null_flush(void *sink)
+{
+    return 0;
+}
+
+static void null_close(void *sink)
+{
+    free(sink);
+}
+
+
+static const storage_sink_t sinks[] = {
+    {"sqlite", sqlite_open, sqlite_write_batch, sqlite_flush, sqlite_close, sqlite_stats},
+    {"tsdb", tsdb_sink_open, tsdb_sink_write_batch, tsdb_sink_flush, tsdb_sink_close, NULL},
+    {"file", file_open, file_write_batch, file_flush, file_close, NULL},
+    {"null", null_open, null_write_batch, null_flush, null_close, NULL},
+};
+
+const storage_sink_t *storage_sink_find(const char *name)
+{
+    for (int i = 0; i < sizeof(sinks)/sizeof(sinks[0]); i++)
+    {
+        if (strcmp(sinks[i].name, name) == 0) return &sinks[i];
+    }
+    return NULL;
+}
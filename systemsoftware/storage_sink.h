@@ -0,0 +1,58 @@
+/**
+ * \author Koen Eelen
+ */
+
+#ifndef _STORAGE_SINK_H_
+#define _STORAGE_SINK_H_
+
+#include <stdlib.h>
+#include "config.h"
+#include "sbuffer.h"
+#include "sensor_db.h"
+
+/*
+ * Binary append file of the "file" sink, a segment file (see sensor_segment_append()) with one record per reading
+ */
+#ifndef FILE_SINK_NAME
+#define FILE_SINK_NAME sensor_data.bin
+#endif
+
+/**
+ * Where the storagemgr writes its batches to. 'open' returns the state that is passed to the other functions,
+ * NULL if the sink can't be opened. 'write_batch' and 'flush' return zero for success and non-zero if an error occurs.
+ * 'stats' is optional: it fills out the fields of storage_stats_t the sink keeps itself (spooled, replayed, reconnects).
+ */
+typedef struct {
+    const char *name;
+    void *(*open)(sbuffer_t *sbuffer);
+    int (*write_batch)(void *sink, sensor_data_t *rows, int count);
+    int (*flush)(void *sink);
+    void (*close)(void *sink);
+    void (*stats)(void *sink, storage_stats_t *stats);
+} storage_sink_t;
+
+/**
+ * Looks up one of the built-in sinks:
+ *  - "sqlite": the DBCONN of sensor_db.h (SQLite, or the TSDB when built with STORAGE_BACKEND=STORAGE_TSDB)
+ *  - "tsdb": the append-only column files of sensor_tsdb.h in TSDB_DIR
+ *  - "file": records appended to the segment file FILE_SINK_NAME
+ *  - "null": only counts the readings, to measure the rest of the gateway without storage
+ * \param name the name of the sink
+ * \return the sink, NULL if there is no sink with that name
+ */
+const storage_sink_t *storage_sink_find(const char *name);
+
+/**
+ * Consumes sensor measurements from 'sbuffer' until it times out and writes them to the sink
+ * The measurements are collected in batches of at most DB_BATCH_SIZE rows or DB_BATCH_MS ms, a dedicated writer
+ * thread writes one batch while the next one is being filled. The sink is flushed before this function returns.
+ * \param sink the sink
+ * \param state the state returned by the 'open' function of the sink, only the writer thread uses it
+ * \param sbuffer the shared buffer to consume from
+ * \param storagemgr_id the consumer id of the storagemgr
+ * \param stats will be filled out with the metrics of the writer
+ * \return zero for success, and non-zero if an error occurs
+ */
+int storage_sink_consume(const storage_sink_t *sink, void *state, sbuffer_t *sbuffer, int storagemgr_id, storage_stats_t *stats);
+
+#endif /* _STORAGE_SINK_H_ */
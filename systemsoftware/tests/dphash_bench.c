@@ -0,0 +1,127 @@
+/**
+ * \author Koen Eelen
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "lib/dphash.h"
+#include "lib/dplist.h"
+
+/*
+ * Microbenchmarks of lib/dphash, with lib/dplist as the baseline for the lookups it replaces:
+ *  dphash_bench [max elements]
+ * For every size the keys are sparse random ints, inserted in random order, looked up in another random order
+ * (hits) and as keys that aren't in the map (misses), iterated and removed again. Times are ns per operation.
+ */
+
+#define LIST_MAX 10000          // dplist lookups are linear, larger lists take too long
+#define MIN_OPS 1000000         // small sizes repeat the lookups to get measurable times
+
+static volatile uintptr_t sink;
+
+static int compare_int(void *x, void *y)
+{
+    return *(int *)x - *(int *)y;
+}
+
+static double elapsed_ns(const struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1e9 + (now.tv_nsec - start->tv_nsec);
+}
+
+static void shuffle(int *keys, int count)
+{
+    for (int i = count - 1; i > 0; i--)
+    {
+        int j = (int)(drand48() * (i + 1));
+        int key = keys[i];
+        keys[i] = keys[j];
+        keys[j] = key;
+    }
+}
+
+static void bench_size(int count)
+{
+    int *keys = malloc(count * sizeof(int));
+    int *missing = malloc(count * sizeof(int));
+    if (keys == NULL || missing == NULL) exit(EXIT_FAILURE);
+    //even keys are in the map, odd ones are misses
+    for (int i = 0; i < count; i++)
+    {
+        keys[i] = 2 * (int)(i * 2654435761u % 1000000007u);
+        missing[i] = keys[i] + 1;
+    }
+    shuffle(keys, count);
+    int rounds = count >= MIN_OPS ? 1 : MIN_OPS / count;
+    struct timespec start;
+
+    dphash_t *map = dph_create_int(NULL, NULL);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < count; i++) dph_insert_int(map, keys[i], &keys[i], false);
+    double insert = elapsed_ns(&start) / count;
+
+    shuffle(keys, count);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int r = 0; r < rounds; r++)
+    {
+        for (int i = 0; i < count; i++) sink += (uintptr_t)dph_get_int(map, keys[i]);
+    }
+    double hit = elapsed_ns(&start) / count / rounds;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int r = 0; r < rounds; r++)
+    {
+        for (int i = 0; i < count; i++) sink += (uintptr_t)dph_get_int(map, missing[i]);
+    }
+    double miss = elapsed_ns(&start) / count / rounds;
+
+    dphash_iter_t iter;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int r = 0; r < rounds; r++)
+    {
+        for (int *element = dph_iter_first(map, &iter); element != NULL; element = dph_iter_next(&iter)) sink += *element;
+    }
+    double iterate = elapsed_ns(&start) / count / rounds;
+
+    shuffle(keys, count);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < count; i++) dph_remove_int(map, keys[i], false);
+    double remove = elapsed_ns(&start) / count;
+    dph_free(&map, false);
+
+    printf("  %9d %9.1f %9.1f %9.1f %9.1f %9.1f", count, insert, hit, miss, iterate, remove);
+
+    if (count <= LIST_MAX)
+    {
+        //the way datamgr and connmgr looked up sensors and connections before dphash
+        dplist_t *list = dpl_create(NULL, NULL, compare_int);
+        for (int i = 0; i < count; i++) dpl_insert_at_index(list, &keys[i], 0, false);
+        int lookups = count < 1000 ? 100000 : 10000;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int i = 0; i < lookups; i++) sink += (uintptr_t)dpl_get_element(list, &keys[i % count]);
+        printf(" %11.1f", elapsed_ns(&start) / lookups);
+        dpl_free(&list, false);
+    }
+    printf("\n");
+    free(keys);
+    free(missing);
+}
+
+int main(int argc, char *argv[])
+{
+    int max = argc > 1 ? atoi(argv[1]) : 1000000;
+    if (max < 10)
+    {
+        printf("Usage: %s [max elements (>= 10)]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    srand48(7);
+    printf("dphash: ns per operation\n");
+    printf("  %9s %9s %9s %9s %9s %9s %11s\n", "elements", "insert", "get hit", "get miss", "iterate", "remove", "dplist get");
+    for (int count = 10; count <= max; count *= 10) bench_size(count);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,293 @@
+/**
+ * \author Koen Eelen
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lib/dphash.h"
+
+/*
+ * Unit tests of lib/dphash:
+ *  dphash_test
+ * Random operations are checked against a plain array of the key space, the element maps get a hash callback
+ * that puts every element in one probe sequence. Exits with EXIT_FAILURE if any check fails.
+ */
+
+#define KEY_SPACE 4096
+#define RANDOM_OPS 200000
+#define GROW_SIZES 1200
+
+static int failures = 0;
+
+#define CHECK(condition)                                                                \
+    do {                                                                                \
+        if (!(condition))                                                               \
+        {                                                                               \
+            if (failures++ < 20) printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+        }                                                                               \
+    } while(0)
+
+/*
+ * Elements of the element maps: 'value' is the key, the hash callback only looks at 'hash'
+ */
+typedef struct {
+    int value;
+    uint64_t hash;
+} item_t;
+
+static uint64_t collision_hash;
+
+static void *item_copy(void *element)
+{
+    item_t *copy = malloc(sizeof(item_t));
+    *copy = *(item_t *)element;
+    return copy;
+}
+
+static void item_free(void **element)
+{
+    free(*element);
+    *element = NULL;
+}
+
+static int item_compare(void *x, void *y)
+{
+    return ((item_t *)x)->value - ((item_t *)y)->value;
+}
+
+static uint64_t item_hash(void *element)
+{
+    return ((item_t *)element)->hash;
+}
+
+static void *int_copy(void *element)
+{
+    int *copy = malloc(sizeof(int));
+    *copy = *(int *)element;
+    return copy;
+}
+
+static void int_free(void **element)
+{
+    free(*element);
+    *element = NULL;
+}
+
+static item_t colliding(int value)
+{
+    item_t item = {value, collision_hash};
+    return item;
+}
+
+/*
+ * Every key of the model is found with the right element, every other key is not, and an iteration visits
+ * exactly the elements of the model
+ */
+static void check_int_map(dphash_t *map, int **model)
+{
+    static int visits[KEY_SPACE];
+    int count = 0;
+    for (int key = 0; key < KEY_SPACE; key++)
+    {
+        CHECK(dph_get_int(map, key) == model[key]);
+        if (model[key] != NULL) count++;
+    }
+    CHECK(dph_size(map) == count);
+
+    dphash_iter_t iter;
+    memset(visits, 0, sizeof(visits));
+    for (int *element = dph_iter_first(map, &iter); element != NULL; element = dph_iter_next(&iter))
+    {
+        CHECK(*element >= 0 && *element < KEY_SPACE && model[*element] == element);
+        if (*element >= 0 && *element < KEY_SPACE) visits[*element]++;
+    }
+    for (int key = 0; key < KEY_SPACE; key++) CHECK(visits[key] == (model[key] != NULL));
+}
+
+/*
+ * Random inserts, lookups and removes of an int map against an array indexed by key, the map grows and migrates
+ * many times along the way
+ */
+static void test_random_ops()
+{
+    int *model[KEY_SPACE] = {NULL};
+    dphash_t *map = dph_create_int(int_copy, int_free);
+    srand48(1);
+    for (int op = 0; op < RANDOM_OPS; op++)
+    {
+        //the key range follows a slow wave, so the map grows as well as shrinks
+        int range = 16 + (int)((KEY_SPACE - 16) * (op % 50000) / 50000.0);
+        int key = (int)(drand48() * range);
+        double choice = drand48();
+        if (choice < 0.5)
+        {
+            dph_insert_int(map, key, &key, true);
+            if (model[key] == NULL) model[key] = dph_get_int(map, key);
+            CHECK(model[key] != NULL && *model[key] == key);
+        } else if (choice < 0.8)
+        {
+            dph_remove_int(map, key, true);
+            model[key] = NULL;
+        }
+        CHECK(dph_get_int(map, key) == model[key]);
+        if (op % 10000 == 0) check_int_map(map, model);
+    }
+    check_int_map(map, model);
+    dph_free(&map, true);
+    CHECK(map == NULL);
+}
+
+/*
+ * Inserting an existing key keeps the first element, a missing key is neither found nor removed
+ */
+static void test_duplicates_and_missing()
+{
+    int a = 1, b = 2;
+    dphash_t *map = dph_create_int(int_copy, int_free);
+    CHECK(dph_iter_first(map, &(dphash_iter_t){0}) == NULL);
+    dph_insert_int(map, -7, &a, false);
+    dph_insert_int(map, -7, &b, false);
+    CHECK(dph_size(map) == 1);
+    CHECK(dph_get_int(map, -7) == &a);
+    CHECK(dph_get_int(map, 7) == NULL);
+    dph_remove_int(map, 7, false);
+    CHECK(dph_size(map) == 1);
+    dph_remove_int(map, -7, false);
+    CHECK(dph_size(map) == 0 && dph_get_int(map, -7) == NULL);
+    dph_free(&map, false);
+
+    CHECK(dph_size(NULL) == -1);
+    CHECK(dph_get_int(NULL, 1) == NULL);
+    CHECK(dph_insert_int(NULL, 1, &a, false) == NULL);
+}
+
+/*
+ * All elements share one hash: they form one probe sequence, lookups only tell them apart with the compare
+ * callback and a remove from the middle must shift the rest of the sequence back without losing any of them.
+ * Every hash value lands on another home slot, some sequences wrap around the end of the table.
+ */
+static void test_colliding_keys()
+{
+    for (collision_hash = 0; collision_hash < 64; collision_hash++)
+    {
+        for (int count = 1; count <= 40; count += 13)
+        {
+            dphash_t *map = dph_create(item_copy, item_free, item_compare, item_hash);
+            for (int i = 0; i < count; i++)
+            {
+                item_t item = colliding(i);
+                dph_insert(map, &item, true);
+            }
+            item_t item = colliding(0);
+            dph_insert(map, &item, true);
+            CHECK(dph_size(map) == count);
+
+            //remove from the middle, then the front and the back of the sequence
+            int order[3] = {count / 2, 0, count - 1};
+            bool removed[40] = {false};
+            for (int r = 0; r < 3; r++)
+            {
+                item = colliding(order[r]);
+                if (!removed[order[r]]) dph_remove(map, &item, true);
+                removed[order[r]] = true;
+                for (int i = 0; i < count; i++)
+                {
+                    item = colliding(i);
+                    item_t *found = dph_get(map, &item);
+                    CHECK(removed[i] ? found == NULL : found != NULL && found->value == i);
+                }
+            }
+            item = colliding(count);
+            CHECK(dph_get(map, &item) == NULL);
+            dph_free(&map, true);
+        }
+    }
+}
+
+/*
+ * Removing through the iterator: every element is still visited exactly once, also the ones that shift into
+ * the slot of a removed element, and the map holds exactly the elements that weren't removed
+ */
+static void test_iter_remove()
+{
+    for (collision_hash = 0; collision_hash < 16; collision_hash++)
+    {
+        dphash_t *map = dph_create(item_copy, item_free, item_compare, item_hash);
+        for (int i = 0; i < 30; i++)
+        {
+            item_t item = colliding(i);
+            dph_insert(map, &item, true);
+        }
+        int visits[30] = {0};
+        dphash_iter_t iter;
+        for (item_t *element = dph_iter_first(map, &iter); element != NULL; element = dph_iter_next(&iter))
+        {
+            visits[element->value]++;
+            if (element->value % 3 == 1) continue;
+            dph_iter_remove(&iter, true);
+            dph_iter_remove(&iter, true);   // a second remove of the same element does nothing
+        }
+        for (int i = 0; i < 30; i++) CHECK(visits[i] == 1);
+        CHECK(dph_size(map) == 10);
+        for (int i = 0; i < 30; i++)
+        {
+            item_t item = colliding(i);
+            CHECK((dph_get(map, &item) != NULL) == (i % 3 == 1));
+        }
+        dph_free(&map, true);
+    }
+}
+
+/*
+ * Iterating right after every insert: the map is caught in every stage of an incremental resize, with elements
+ * in the new and the old table. Every other iteration removes a third of the elements through the iterator.
+ */
+static void test_iterate_while_growing()
+{
+    int *model[KEY_SPACE] = {NULL};
+    dphash_t *map = dph_create_int(int_copy, int_free);
+    for (int n = 0; n < GROW_SIZES; n++)
+    {
+        int key = (n * 7) % KEY_SPACE;
+        dph_insert_int(map, key, &key, true);
+        model[key] = dph_get_int(map, key);
+        if (n % 2 == 0)
+        {
+            check_int_map(map, model);
+            continue;
+        }
+
+        int visits[KEY_SPACE] = {0};
+        dphash_iter_t iter;
+        for (int *element = dph_iter_first(map, &iter); element != NULL; element = dph_iter_next(&iter))
+        {
+            int value = *element;
+            visits[value]++;
+            if (value % 3 == 0)
+            {
+                dph_iter_remove(&iter, true);
+                model[value] = NULL;
+            }
+        }
+        for (int k = 0; k < KEY_SPACE; k++) CHECK(visits[k] <= 1 && (visits[k] == 1 || model[k] == NULL));
+        check_int_map(map, model);
+    }
+    dph_free(&map, true);
+}
+
+int main(void)
+{
+    test_duplicates_and_missing();
+    test_random_ops();
+    test_colliding_keys();
+    test_iter_remove();
+    test_iterate_while_growing();
+    if (failures > 0)
+    {
+        printf("dphash: %d checks failed\n", failures);
+        return EXIT_FAILURE;
+    }
+    printf("dphash: all tests passed\n");
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,236 @@
+/**
+ * \author Koen Eelen
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <float.h>
+#include <limits.h>
+#include <unistd.h>
+#include <time.h>
+#include <ftw.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "config.h"
+#include "sensor_db.h"
+
+/*
+ * Tests of the read-only connection pool of sensor_db:
+ *  pool_test
+ * READERS threads borrow connections from a pool of POOL_SIZE and stream the rows of one sensor while the main
+ * thread commits BATCHES batches of DB_BATCH_SIZE rows on its own connection. A reader must only ever see whole
+ * batches, and never fewer rows than it saw before. Afterwards the pool is held empty on purpose to check that a
+ * borrow waits for a release and times out after DB_POOL_WAIT_MS. The pool stats must match what the threads
+ * counted themselves. Runs in a scratch directory, exits with EXIT_FAILURE if any check fails.
+ */
+
+#define POOL_SIZE 3
+#define READERS 6
+#define BATCHES 40
+#define SENSOR_ID 1
+#define RELEASE_DELAY_MS 100
+
+static int failures = 0;
+
+#define CHECK(condition)                                                                \
+    do {                                                                                \
+        if (!(condition))                                                               \
+        {                                                                               \
+            if (failures++ < 20) printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+        }                                                                               \
+    } while(0)
+
+static sensor_db_pool_t *pool;
+static atomic_int stop;
+static sensor_ts_t base_ts;
+
+typedef struct {
+    pthread_t thread;
+    unsigned long borrows;
+    unsigned long timeouts;
+    unsigned long queries;
+    long last_rows;                 /**< rows seen by the latest query */
+    unsigned long torn;             /**< queries that saw part of a batch */
+    unsigned long shrunk;           /**< queries that saw fewer rows than the one before */
+} reader_t;
+
+static int remove_file(const char *path, const struct stat *st, int flag, struct FTW *ftw)
+{
+    return remove(path);
+}
+
+static double elapsed_ms(const struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1e3 + (now.tv_nsec - start->tv_nsec) / 1e6;
+}
+
+/*
+ * Number of rows of SENSOR_ID a query on 'conn' returns, -1 if the query fails
+ */
+static long count_rows(DBCONN *conn)
+{
+    sensor_db_filter_t filter = {SENSOR_ID, 0, INT64_MAX, -DBL_MAX, DBL_MAX};
+    sensor_db_query_t *query = sensor_db_query_open(conn, &filter, 256);
+    if (query == NULL) return -1;
+    long rows = 0;
+    int count;
+    sensor_data_t *batch;
+    while ((count = sensor_db_query_next(query, &batch)) > 0) rows += count;
+    sensor_db_query_close(&query);
+    return count < 0 ? -1 : rows;
+}
+
+static void *run_reader(void *arg)
+{
+    reader_t *reader = arg;
+    while (!atomic_load(&stop))
+    {
+        DBCONN *conn = sensor_db_pool_borrow(pool);
+        if (conn == NULL)
+        {
+            reader->timeouts++;
+            continue;
+        }
+        reader->borrows++;
+        long rows = count_rows(conn);
+        sensor_db_pool_release(pool, conn);
+        CHECK(rows >= 0);
+        reader->queries++;
+        if (rows % DB_BATCH_SIZE != 0) reader->torn++;
+        if (rows < reader->last_rows) reader->shrunk++;
+        reader->last_rows = rows;
+    }
+    return NULL;
+}
+
+static void *run_borrower(void *arg)
+{
+    return sensor_db_pool_borrow(pool);
+}
+
+/*
+ * Borrowers and the writer at the same time
+ */
+static void test_borrow_while_writing(DBCONN *writer)
+{
+    static reader_t readers[READERS];
+    for (int i = 0; i < READERS; i++) pthread_create(&readers[i].thread, NULL, run_reader, &readers[i]);
+
+    sensor_data_t *rows = malloc(DB_BATCH_SIZE * sizeof(sensor_data_t));
+    if (rows == NULL) exit(EXIT_FAILURE);
+    for (int b = 0; b < BATCHES; b++)
+    {
+        for (int i = 0; i < DB_BATCH_SIZE; i++)
+        {
+            long k = (long)b * DB_BATCH_SIZE + i;
+            rows[i] = (sensor_data_t){SENSOR_ID, 15 + (k % 100) * 0.01, base_ts + k};
+        }
+        CHECK(insert_sensor_batch(writer, rows, DB_BATCH_SIZE) == 0);
+    }
+    free(rows);
+    atomic_store(&stop, 1);
+
+    unsigned long borrows = 0, timeouts = 0, queries = 0, torn = 0, shrunk = 0;
+    for (int i = 0; i < READERS; i++)
+    {
+        pthread_join(readers[i].thread, NULL);
+        borrows += readers[i].borrows;
+        timeouts += readers[i].timeouts;
+        queries += readers[i].queries;
+        torn += readers[i].torn;
+        shrunk += readers[i].shrunk;
+    }
+    printf("pool: %d readers on %d connections, %lu queries during %d batches\n", READERS, POOL_SIZE, queries, BATCHES);
+    CHECK(queries > 0);
+    CHECK(torn == 0);
+    CHECK(shrunk == 0);
+
+    DBCONN *conn = sensor_db_pool_borrow(pool);
+    CHECK(conn != NULL && count_rows(conn) == (long)BATCHES * DB_BATCH_SIZE);
+    //a pool connection is read-only
+    sensor_data_t row = {SENSOR_ID, 20, base_ts};
+    if (conn != NULL) CHECK(insert_sensor_batch(conn, &row, 1) != 0);
+    if (conn != NULL) sensor_db_pool_release(pool, conn);
+
+    sensor_db_pool_stats_t stats;
+    sensor_db_pool_get_stats(pool, &stats);
+    CHECK(stats.borrows == borrows + 1);
+    CHECK(stats.timeouts == timeouts);
+    CHECK(stats.waits <= stats.borrows + stats.timeouts);
+    CHECK(stats.max_wait_ms <= stats.total_wait_ms);
+    CHECK(stats.max_wait_ms <= DB_POOL_WAIT_MS * 1.5);
+}
+
+/*
+ * With every connection borrowed, a borrow waits until one is released, or gives up after DB_POOL_WAIT_MS
+ */
+static void test_wait_and_timeout()
+{
+    sensor_db_pool_stats_t before, after;
+    sensor_db_pool_get_stats(pool, &before);
+    DBCONN *held[POOL_SIZE];
+    for (int i = 0; i < POOL_SIZE; i++)
+    {
+        held[i] = sensor_db_pool_borrow(pool);
+        CHECK(held[i] != NULL);
+    }
+
+    pthread_t borrower;
+    void *borrowed;
+    pthread_create(&borrower, NULL, run_borrower, NULL);
+    struct timespec pause = {0, RELEASE_DELAY_MS * 1000000L};
+    nanosleep(&pause, NULL);
+    sensor_db_pool_release(pool, held[0]);
+    pthread_join(borrower, &borrowed);
+    CHECK(borrowed == held[0]);
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    CHECK(sensor_db_pool_borrow(pool) == NULL);
+    double waited = elapsed_ms(&start);
+    CHECK(waited >= DB_POOL_WAIT_MS * 0.9);
+    for (int i = 0; i < POOL_SIZE; i++) sensor_db_pool_release(pool, held[i]);
+
+    sensor_db_pool_get_stats(pool, &after);
+    CHECK(after.borrows == before.borrows + POOL_SIZE + 1);
+    CHECK(after.waits == before.waits + 2);
+    CHECK(after.timeouts == before.timeouts + 1);
+    CHECK(after.max_wait_ms >= waited * 0.9);
+    CHECK(after.total_wait_ms - before.total_wait_ms >= RELEASE_DELAY_MS * 0.9 + waited * 0.9);
+}
+
+int main(void)
+{
+    char cwd[PATH_MAX];
+    char dir[] = "/tmp/pool_test.XXXXXX";
+    if (getcwd(cwd, sizeof(cwd)) == NULL || mkdtemp(dir) == NULL || chdir(dir) != 0) return EXIT_FAILURE;
+    base_ts = time(NULL);
+
+    //a read-only open can't create the database
+    CHECK(sensor_db_pool_create(POOL_SIZE) == NULL);
+
+    DBCONN *writer = init_connection(1, NULL);
+    pool = sensor_db_pool_create(POOL_SIZE);
+    CHECK(pool != NULL);
+    if (pool != NULL)
+    {
+        test_borrow_while_writing(writer);
+        test_wait_and_timeout();
+        sensor_db_pool_free(&pool);
+        CHECK(pool == NULL);
+    }
+    disconnect(writer);
+
+    if (chdir(cwd) != 0) return EXIT_FAILURE;
+    nftw(dir, remove_file, 16, FTW_DEPTH | FTW_PHYS);
+    if (failures > 0)
+    {
+        printf("pool: %d checks failed\n", failures);
+        return EXIT_FAILURE;
+    }
+    printf("pool: all tests passed\n");
+    return EXIT_SUCCESS;
+}
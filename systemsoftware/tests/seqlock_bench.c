@@ -0,0 +1,161 @@
+/**
+ * \author Koen Eelen
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "config.h"
+#include "datamgr.h"
+#include "sbuffer.h"
+
+/*
+ * Stress benchmark of the datamgr seqlock:
+ *  seqlock_bench [readers] [seconds]
+ * A producer feeds one sensor through the sbuffer as fast as the datamgr applies the readings, while 'readers'
+ * threads call datamgr_get_snapshot() in a loop. The reading with timestamp BASE_TS + k has value reading_value(k),
+ * so the running avg is a known function of last_modified: a snapshot that pairs the avg of one update with the
+ * timestamp of another one is torn. Exits with EXIT_FAILURE if any torn snapshot was seen.
+ */
+
+#define BENCH_ID 22
+#define SENSOR_ID 1
+#define ROOM_ID 1
+#define BASE_TS 1000000
+#define MAX_IN_FLIGHT 4096      // readings the producer runs ahead of the datamgr
+#define MAX_READERS 64
+
+static sbuffer_t *sbuffer;
+static atomic_int stop;
+
+typedef struct {
+    pthread_t thread;
+    unsigned long reads;
+    unsigned long checked;
+    unsigned long torn;
+} reader_t;
+
+/*
+ * Triangle wave between 10 and 15 degrees in steps of 0.01: no alerts and nothing the anomaly detectors flag
+ */
+static double reading_value(long k)
+{
+    return 10 + labs(k % 1000 - 500) * 0.01;
+}
+
+static double expected_avg(long k)
+{
+    double sum = 0;
+    for (int i = 0; i < RUN_AVG_LENGTH; i++) sum += reading_value(k - i);
+    return sum / RUN_AVG_LENGTH;
+}
+
+static long applied_readings()
+{
+    sensor_snapshot_t snapshot;
+    if (datamgr_get_snapshot(SENSOR_ID, &snapshot) != 0 || snapshot.last_modified < BASE_TS) return 0;
+    return snapshot.last_modified - BASE_TS;
+}
+
+static void *run_datamgr(void *arg)
+{
+    datamgr_parse_from_buffer(arg, sbuffer, BENCH_ID);
+    return NULL;
+}
+
+static void *run_producer(void *arg)
+{
+    long *produced = arg;
+    for (long k = 1; !atomic_load(&stop); k++)
+    {
+        while (k - applied_readings() > MAX_IN_FLIGHT && !atomic_load(&stop)) sched_yield();
+        sensor_data_t data = {SENSOR_ID, reading_value(k), BASE_TS + k};
+        sbuffer_insert(sbuffer, &data);
+        *produced = k;
+    }
+    return NULL;
+}
+
+static void *run_reader(void *arg)
+{
+    reader_t *reader = arg;
+    sensor_snapshot_t snapshot;
+    while (!atomic_load_explicit(&stop, memory_order_relaxed))
+    {
+        if (datamgr_get_snapshot(SENSOR_ID, &snapshot) != 0) continue;
+        reader->reads++;
+        long k = snapshot.last_modified - BASE_TS;
+        if (k <= RUN_AVG_LENGTH) continue;
+        reader->checked++;
+        if (fabs(snapshot.running_avg - expected_avg(k)) > 1e-9 || snapshot.room_id != ROOM_ID) reader->torn++;
+    }
+    return NULL;
+}
+
+static double elapsed_s(const struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+int main(int argc, char *argv[])
+{
+    int reader_count = argc > 1 ? atoi(argv[1]) : 4;
+    double seconds = argc > 2 ? atof(argv[2]) : 3;
+    if (reader_count < 1 || reader_count > MAX_READERS || seconds <= 0)
+    {
+        printf("Usage: %s [readers (1-%d)] [seconds]\n", argv[0], MAX_READERS);
+        return EXIT_FAILURE;
+    }
+
+    FILE *fp_map = tmpfile();
+    if (fp_map == NULL) return EXIT_FAILURE;
+    fprintf(fp_map, "%d %d\n", ROOM_ID, SENSOR_ID);
+    rewind(fp_map);
+
+    sbuffer_init(&sbuffer);
+    sbuffer_insert_consumer_id(sbuffer, BENCH_ID);
+    pthread_t datamgr_thread, producer_thread;
+    pthread_create(&datamgr_thread, NULL, run_datamgr, fp_map);
+    while (datamgr_get_total_sensors() != 1) sched_yield();
+
+    static reader_t readers[MAX_READERS];
+    long produced = 0;
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    pthread_create(&producer_thread, NULL, run_producer, &produced);
+    for (int i = 0; i < reader_count; i++) pthread_create(&readers[i].thread, NULL, run_reader, &readers[i]);
+
+    struct timespec pause = {(time_t)seconds, (long)((seconds - (time_t)seconds) * 1e9)};
+    nanosleep(&pause, NULL);
+    atomic_store(&stop, 1);
+    long applied = applied_readings();
+    double duration = elapsed_s(&start);
+
+    pthread_join(producer_thread, NULL);
+    sbuffer_remove_locks(sbuffer);         // what connmgr does when it stops, the datamgr no longer waits for data
+    unsigned long reads = 0, checked = 0, torn = 0;
+    for (int i = 0; i < reader_count; i++)
+    {
+        pthread_join(readers[i].thread, NULL);
+        reads += readers[i].reads;
+        checked += readers[i].checked;
+        torn += readers[i].torn;
+    }
+
+    printf("seqlock: %d readers, %.1f s\n", reader_count, duration);
+    printf("  reads:   %lu (%.0f/s, %.0f/s per reader), %lu checked, %lu torn\n",
+           reads, reads / duration, reads / duration / reader_count, checked, torn);
+    printf("  updates: %ld applied of %ld produced (%.0f/s)\n", applied, produced, applied / duration);
+
+    pthread_join(datamgr_thread, NULL);    // returns TIMEOUT s after the last reading
+    datamgr_free();
+    sbuffer_free(&sbuffer);
+    fclose(fp_map);
+    return torn == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
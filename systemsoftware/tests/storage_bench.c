@@ -0,0 +1,134 @@
+/**
+ * \author Koen Eelen
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <unistd.h>
+#include <time.h>
+#include <ftw.h>
+#include "config.h"
+#include "storage_sink.h"
+
+/*
+ * Disk footprint and write rate of the storage sinks:
+ *  storage_bench [sensors] [readings per sensor]
+ * Every sink writes the same readings, one per sensor per second, sensor values follow a random walk like sensor_node
+ * produces them. The batches are handed to the sink the way the storagemgr does, then the sink is flushed and
+ * closed. Each sink runs in its own scratch directory, the bytes of all files left in it are counted. The last column
+ * is the disk footprint of the sqlite sink divided by that of the sink.
+ */
+
+#define BASE_TS 1700000000
+#define TEMP_START 15.0
+#define TEMP_STEP 0.1
+
+static const char *sink_names[] = {"sqlite", "tsdb", "file"};
+
+static off_t disk_bytes;
+
+static int add_file(const char *path, const struct stat *st, int flag, struct FTW *ftw)
+{
+    if (flag == FTW_F) disk_bytes += st->st_size;
+    return 0;
+}
+
+static int remove_file(const char *path, const struct stat *st, int flag, struct FTW *ftw)
+{
+    return remove(path);
+}
+
+static double elapsed_s(const struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/*
+ * Writes all readings through 'sink' in the current directory
+ * \return zero for success, and non-zero if an error occurs
+ */
+static int write_readings(const storage_sink_t *sink, int sensors, int readings, double *seconds)
+{
+    void *state = sink->open(NULL);
+    if (state == NULL) return 1;
+
+    sensor_data_t *batch = malloc(DB_BATCH_SIZE * sizeof(sensor_data_t));
+    double *values = malloc(sensors * sizeof(double));
+    if (batch == NULL || values == NULL) exit(EXIT_FAILURE);
+    for (int s = 0; s < sensors; s++) values[s] = TEMP_START;
+    srand48(42);
+
+    int result = 0, count = 0;
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int r = 0; r < readings && result == 0; r++)
+    {
+        for (int s = 0; s < sensors && result == 0; s++)
+        {
+            values[s] += TEMP_STEP * (drand48() - 0.5);
+            batch[count++] = (sensor_data_t){s + 1, values[s], BASE_TS + r};
+            if (count == DB_BATCH_SIZE)
+            {
+                result = sink->write_batch(state, batch, count);
+                count = 0;
+            }
+        }
+    }
+    if (result == 0 && count > 0) result = sink->write_batch(state, batch, count);
+    if (result == 0) result = sink->flush(state);
+    *seconds = elapsed_s(&start);
+    sink->close(state);
+
+    free(values);
+    free(batch);
+    return result;
+}
+
+int main(int argc, char *argv[])
+{
+    int sensors = argc > 1 ? atoi(argv[1]) : 20;
+    int readings = argc > 2 ? atoi(argv[2]) : 5000;
+    if (sensors < 1 || sensors > UINT16_MAX || readings < 1)
+    {
+        printf("Usage: %s [sensors (1-%d)] [readings per sensor]\n", argv[0], UINT16_MAX);
+        return EXIT_FAILURE;
+    }
+
+    char cwd[PATH_MAX];
+    if (getcwd(cwd, sizeof(cwd)) == NULL) return EXIT_FAILURE;
+    long total = (long)sensors * readings;
+    printf("storage: %d sensors x %d readings = %ld readings\n", sensors, readings, total);
+    printf("  %-8s %12s %10s %12s %10s\n", "sink", "disk bytes", "B/reading", "readings/s", "vs sqlite");
+
+    int failed = 0;
+    off_t sqlite_bytes = 0;
+    for (int i = 0; i < sizeof(sink_names)/sizeof(sink_names[0]); i++)
+    {
+        char dir[] = "/tmp/storage_bench.XXXXXX";
+        if (mkdtemp(dir) == NULL || chdir(dir) != 0) return EXIT_FAILURE;
+
+        double seconds;
+        if (write_readings(storage_sink_find(sink_names[i]), sensors, readings, &seconds) != 0)
+        {
+            printf("  %-8s failed\n", sink_names[i]);
+            failed = 1;
+        } else
+        {
+            disk_bytes = 0;
+            nftw(".", add_file, 16, FTW_PHYS);
+            if (i == 0) sqlite_bytes = disk_bytes;
+            printf("  %-8s %12lld %10.2f %12.0f %9.1fx\n", sink_names[i], (long long)disk_bytes,
+                   (double)disk_bytes / total, total / seconds, (double)sqlite_bytes / disk_bytes);
+        }
+
+        if (chdir(cwd) != 0) return EXIT_FAILURE;
+        nftw(dir, remove_file, 16, FTW_DEPTH | FTW_PHYS);
+    }
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}